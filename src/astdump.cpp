@@ -1,43 +1,151 @@
 #include <parser.h>
 
+#include <algorithm>
+#include <chrono>
+#include <filesystem>
 #include <iostream>
-#include <iterator>
 #include <string>
 #include <vector>
 #include <cstring>
 
-std::string help(R"%(astdump [-i] [-t] <filename>
-  filename: name of the file to dump the AST of.
+std::string help(R"%(astdump [-i] [-t [-b]] [-c <dir>] [-j <n>] <filename>...
+  filename: name of the file to dump the AST of. Streams stdin if omitted.
+    Given several files or a directory, every file under them is dumped in
+    turn after a "==> filename <==" line, and a summary goes to stderr.
+    Input that cannot be read or has errors makes astdump exit with 1, and
+    such files count as failed in the summary.
   -i: interactive mode. Overrides filename.
-  -t: tokenize instead of parse.)%");
+  -t: tokenize instead of parse.
+  -b: with -t, write binary records: the 8 bytes "LANGTOK\1", then per token
+    the kind byte, offset (8 bytes) and length (4 bytes), little-endian.
+  -c: cache ASTs in dir, named by content hash, and reuse them while the
+    file is unchanged.
+  -j: dump several files on n threads. All cores if 0 or omitted.)%");
 
 using namespace lang::parser;
 
-void tokenize(State& s)
+const std::string_view token_magic{"LANGTOK\1", 8};
+
+// Offsets in binary records count from the start of the whole input, and
+// the magic goes before the chunk at 0. Returns the tape, which like a
+// file's ends early at the first byte no token starts with.
+Tape tokenize(Printer& out, const State& s, bool binary)
 {
-  std::pair<State::Token, std::string> tkn;
-  while (s && (tkn = s.token()).first != State::UNKNOWN && tkn.first != State::EOI)
+  uint64_t base{s.source ? s.source->origin.offset : 0};
+  Tape tape{Tape::lex(s)};
+  if (!binary)
+  {
+    out.print(tape);
+  }
+  else
   {
-    std::cout << State::token_to_string(tkn.first) << ":" << tkn.second << std::endl;
+    (base == 0 ? out.print(token_magic) : out).records(tape, base);
   }
+  return tape;
 }
 
-void parse(State& s)
+// Writes out what `out` holds. False, with a message, if any of its
+// output could not be written, so astdump can exit non-zero.
+bool finish(Printer& out)
 {
+  bool ok{out.flush()};
+  if (!ok)
+  {
+    std::cerr << "Could not write the output." << std::endl;
+  }
+  return ok;
+}
+
+// Prints each form as soon as it is parsed and frees it before the next,
+// so memory stays at the size of the largest form. Errors are collected
+// and parsing carries on past them. Given `flat`, each form is also added
+// to it, and its span to `spans`. Returns how many tokens were parsed.
+size_t print_forms(Printer& out, State& s, std::vector<Diagnostic>& diagnostics, FlatFile *flat = nullptr,
+                 std::vector<std::pair<size_t, size_t>> *spans = nullptr)
+{
+  Forms forms{s, &diagnostics};
+  size_t start{forms.state.index};
+  while (auto v = forms.next())
+  {
+    out.print(*v);
+    if (flat)
+    {
+      flat->add(*v);
+      spans->emplace_back(start, forms.state.index);
+    }
+    start = forms.state.index;
+  }
+  return forms.tokens;
+}
+
+void print_diagnostics(Printer& out, const std::vector<Diagnostic>& diagnostics)
+{
+  for (auto& d : diagnostics)
+  {
+    out.print(d.message).print("\n");
+  }
+}
+
+// Prints the same as File::print(), form by form, then every error.
+bool parse(State& s)
+{
+  std::cout.flush();
+  Printer out{1};
+  std::vector<Diagnostic> diagnostics;
+  out.print("File(");
+  print_forms(out, s, diagnostics);
+  out.print(")\n");
+  print_diagnostics(out, diagnostics);
+  return finish(out);
+}
+
+// Same as parse() over the whole input, but read as it comes in, so output
+// starts before stdin is closed. False if the input had errors too.
+bool from_stdin(bool tknize, bool binary)
+{
+  Stream stream{0, "(stdin)"};
+  State s;
+  std::vector<Diagnostic> diagnostics;
+  Printer out{1};
+  bool lexed{true};
+  bool broken{false};
+
+  if (!tknize)
+  {
+    out.print("File(");
+  }
   try
   {
-    File f;
-    f.parse(s);
-    std::cout << f.print() << std::endl;
+    while (lexed && out.flush() && (s = stream.next()))
+    {
+      if (tknize)
+      {
+        lexed = tokenize(out, s, binary).end == s.len;
+      }
+      else
+      {
+        print_forms(out, s, diagnostics);
+      }
+      std::cout.flush();
+    }
+    if (!tknize)
+    {
+      out.print(")\n");
+      print_diagnostics(out, diagnostics);
+    }
   }
   catch (std::runtime_error& e)
   {
-    std::cout << e.what() << std::endl;
+    std::cout.flush();
+    out.print("\n").print(e.what()).print("\n");
+    broken = true;
   }
+  return finish(out) && !broken && diagnostics.empty();
 }
 
-void interactive(bool tknize)
+bool interactive(bool tknize, bool binary)
 {
+  bool ok{true};
   std::string line;
   std::cout << "> ";
   while (std::cin >> line)
@@ -46,63 +154,204 @@ void interactive(bool tknize)
     {
       break;
     }
-    State s{State::from_string(line)};
-    s.filename = "(console)";
+    State s{State::from_string(line, "(console)")};
     if (tknize)
     {
-      tokenize(s);
+      std::cout.flush();
+      Printer out{1};
+      tokenize(out, s, binary);
+      ok = finish(out) && ok;
     }
     else
     {
-      parse(s);
+      ok = parse(s) && ok;
     }
-    
+
     std::cout << "> ";
   }
+  return ok;
 }
 
-State from_file(const std::string& fname)
+// What is known about one dumped file, kept in batch mode until the
+// files before it have been written.
+struct Outcome
 {
-  State state(lang::parser::State::from_file(fname));
+  std::string output;
+  size_t bytes{0};
+  size_t tokens{0};
+  size_t diagnostics{0};
+  bool cached{false};
+  bool failed{false};
+};
 
-  if (!state)
+// Prints the tree form by form as it is parsed, then every error, as
+// parse() does. With a cache dir, prints the cached tree instead when one
+// was saved from exactly this text, and otherwise caches the tree unless
+// it has errors; only its flat nodes are then kept until the end.
+void parse_cached(Printer& out, State& s, const std::string& fname, const std::string& cache_dir, Outcome& o)
+{
+  std::string_view text{s.buffer, s.len};
+  std::string path{cache_dir.empty() ? "" : AstCache::path(fname, text, cache_dir)};
+
+  if (auto cache = path.empty() ? nullptr : AstCache::load(path, text))
   {
-    std::cerr << "Empty or nonexistent file at " << fname << std::endl;
-    exit(1);
+    out.print(*cache).print("\n");
+    o.cached = true;
+    return;
   }
 
-  return state;
+  FlatFile flat;
+  std::vector<std::pair<size_t, size_t>> spans;
+  std::vector<Diagnostic> diagnostics;
+  out.print("File(");
+  o.tokens = print_forms(out, s, diagnostics, path.empty() ? nullptr : &flat, &spans);
+  out.print(")\n");
+  print_diagnostics(out, diagnostics);
+  o.diagnostics = diagnostics.size();
+  if (!path.empty() && diagnostics.empty())
+  {
+    flat.finish();
+    AstCache::save(path, std::move(flat), spans, text);
+  }
 }
 
-State from_stdin()
+// The files named, with each directory replaced by the files under it in
+// sorted order, so output comes in the same order on every run. Caches
+// found there are left out.
+std::vector<std::string> expand(const std::vector<std::string>& names)
 {
-  std::istreambuf_iterator<char> begin(std::cin), end;
-  std::string input(begin, end);
+  namespace fs = std::filesystem;
+  std::vector<std::string> out;
 
-  State s{State::from_string(input)};
-  s.filename = "(stdin)";
+  for (auto& name : names)
+  {
+    std::error_code ec;
+    if (!fs::is_directory(name, ec))
+    {
+      out.push_back(name);
+      continue;
+    }
 
-  return s;
+    std::vector<std::string> found;
+    for (fs::recursive_directory_iterator it{name, ec}, end; !ec && it != end; it.increment(ec))
+    {
+      if (it->is_regular_file(ec) && it->path().extension() != ".ast")
+      {
+        found.push_back(it->path().string());
+      }
+    }
+    std::sort(found.begin(), found.end());
+    out.insert(out.end(), found.begin(), found.end());
+  }
+
+  return out;
 }
 
-int main(int argc, char **argv)
+// Dumps every file on a pool of `threads`. Each file gets its own File,
+// and so its own arena, and the parser keeps its stacks per thread.
+// Outcomes are held for a window of files at a time and written in the
+// order given, then totals go to stderr. Returns whether every file was
+// read and dumped without errors and the output was written.
+bool batch(const std::vector<std::string>& files, bool tknize, const std::string& cache_dir, size_t threads)
 {
-  if (argc > 3)
+  auto start{std::chrono::steady_clock::now()};
+  Pool pool{threads};
+  const size_t window{16 * pool.size()};
+  std::vector<Outcome> outcomes(window);
+  Outcome total;
+  size_t failed{0}, cached{0};
+  Printer out{1};
+
+  for (size_t first = 0; first < files.size(); first += window)
   {
-    std::cerr << "Bad number of arguments." << std::endl
-      << help << std::endl;
-    return 1;
+    size_t count{std::min(window, files.size() - first)};
+    pool.run(count, [&](size_t i, size_t) {
+      const std::string& fname{files[first + i]};
+      Outcome& o{outcomes[i]};
+
+      // Anything thrown here would end the whole run from a pool thread,
+      // so every exception becomes this file's error.
+      o = Outcome{};
+      try
+      {
+        Printer p;
+        p.print("==> ").print(fname).print(" <==\n");
+        State s{State::from_file(fname)};
+        o.bytes = s.len;
+        if (!s)
+        {
+          p.print("Empty or nonexistent file at ").print(fname).print("\n");
+          o.failed = true;
+        }
+        else if (tknize)
+        {
+          o.tokens = tokenize(p, s, false).size();
+        }
+        else
+        {
+          parse_cached(p, s, fname, cache_dir, o);
+        }
+        o.failed = o.failed || o.diagnostics > 0;
+        o.output = p.str();
+      }
+      catch (std::exception& e)
+      {
+        o.output = "==> " + fname + " <==\n" + e.what() + "\n";
+        o.failed = true;
+      }
+    });
+
+    for (size_t i = 0; i < count; i++)
+    {
+      const Outcome& o{outcomes[i]};
+      out.print(o.output);
+      total.bytes += o.bytes;
+      total.tokens += o.tokens;
+      total.diagnostics += o.diagnostics;
+      cached += o.cached;
+      failed += o.failed;
+    }
   }
+  bool written{finish(out)};
+
+  double secs{std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count()};
+  std::cerr << files.size() << " files (" << failed << " failed, " << cached << " cached), "
+    << total.bytes << " bytes, " << total.tokens << (tknize ? " tokens, " : " parsed tokens, ")
+    << total.diagnostics << " diagnostics in "
+    << secs << " s on " << pool.size() << " threads, " << total.bytes / secs / (1024 * 1024) << " MB/s"
+    << std::endl;
+
+  return failed == 0 && written;
+}
 
+State from_file(const std::string& fname)
+{
+  State state(lang::parser::State::from_file(fname));
+
+  if (!state)
+  {
+    std::cerr << "Empty or nonexistent file at " << fname << std::endl;
+    exit(1);
+  }
+
+  return state;
+}
+
+int main(int argc, char **argv)
+{
   if (argc == 1)
   {
-    return from_stdin();
+    return from_stdin(false, false) ? 0 : 1;
   }
   else
   {
     bool interact{false};
     bool tknize{false};
-    std::string fname;
+    bool binary{false};
+    bool jobs{false};
+    size_t threads{0};
+    std::vector<std::string> names;
+    std::string cache_dir;
     for (int i = 1; i < argc; i++)
     {
       size_t len = strlen(argv[i]);
@@ -114,35 +363,67 @@ int main(int argc, char **argv)
       {
         tknize = true;
       }
+      else if (len == 2 && strncmp("-b", argv[i], 2) == 0)
+      {
+        binary = true;
+      }
+      else if (len == 2 && strncmp("-c", argv[i], 2) == 0 && i + 1 < argc)
+      {
+        cache_dir = argv[++i];
+      }
+      else if (len == 2 && strncmp("-j", argv[i], 2) == 0 && i + 1 < argc)
+      {
+        jobs = true;
+        threads = strtoul(argv[++i], nullptr, 10);
+      }
+      else if (len == 2 && argv[i][0] == '-')
+      {
+        std::cerr << "Bad arguments." << std::endl
+          << help << std::endl;
+        return 1;
+      }
       else
       {
-        fname = argv[i];
+        names.push_back(argv[i]);
       }
     }
 
-    State s;
-    if (!interact && fname.size() == 0)
+    std::error_code ec;
+    bool many{jobs || names.size() > 1 || (names.size() == 1 && std::filesystem::is_directory(names[0], ec))};
+
+    if (interact)
     {
-      s = from_stdin();
+      return interactive(tknize, binary) ? 0 : 1;
     }
-    else if (fname.size() > 0)
+    else if (names.empty())
     {
-      s = from_file(fname);
+      return from_stdin(tknize, binary) ? 0 : 1;
     }
-
-    if (interact)
+    else if (many && binary)
     {
-      interactive(tknize);
+      std::cerr << "Binary tokens are only written for a single file." << std::endl;
+      return 1;
+    }
+    else if (many)
+    {
+      return batch(expand(names), tknize, cache_dir, threads) ? 0 : 1;
     }
     else if (tknize)
     {
-      tokenize(s);
+      State s{from_file(names[0])};
+      Printer out{1};
+      tokenize(out, s, binary);
+      return finish(out) ? 0 : 1;
     }
     else
     {
-      parse(s);
+      State s{from_file(names[0])};
+      Printer out{1};
+      Outcome o;
+      parse_cached(out, s, names[0], cache_dir, o);
+      return finish(out) && o.diagnostics == 0 ? 0 : 1;
     }
   }
 
   return 0;
-}
\ No newline at end of file
+}
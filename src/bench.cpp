@@ -0,0 +1,759 @@
+#include <parser.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <fstream>
+#include <new>
+#include <iostream>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+using namespace lang::parser;
+
+// Counts heap allocations made through operator new, including the ones
+// inside liblang.
+size_t alloc_count{0};
+
+void *operator new(size_t size)
+{
+  alloc_count++;
+  void *p{malloc(size)};
+  if (!p)
+  {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+// Counts every exception thrown in the process, including ones caught
+// inside liblang, by interposing the C++ runtime's throw entry point.
+size_t throw_count{0};
+
+extern "C" void __cxa_throw(void *obj, void *type, void (*dest)(void *))
+{
+  using cxa_throw_t = void (*)(void *, void *, void (*)(void *));
+  static cxa_throw_t real{reinterpret_cast<cxa_throw_t>(dlsym(RTLD_NEXT, "__cxa_throw"))};
+
+  throw_count++;
+  real(obj, type, dest);
+  __builtin_unreachable();
+}
+
+// The std::regex scanner State::token() used before the DFA lexer. Kept here
+// as the baseline for throughput numbers and as a reference for the output.
+namespace legacy {
+  const std::vector<std::pair<State::Token, std::regex>> regexes({
+    {State::CHAR,     std::regex{R"%(^'([^\\]|\\([abftvrn'\\]|(x([0-9a-fA-F]{2}))))')%"}},
+    {State::SYMBOL,   std::regex{R"%(^'[a-zA-Z~!@$%^&*_+=|:<>?/]+[a-zA-Z0-9~!@$%^&*_+=|:<>.?/-]*)%"}},
+    {State::RATIONAL, std::regex{R"%(^-?[0-9]+/-?[0-9]+)%"}},
+    {State::BIN,      std::regex{R"%(^-?0b[01]+)%"}},
+    {State::OCT,      std::regex{R"%(^-?0o[0-7]+)%"}},
+    {State::HEX,      std::regex{R"%(^-?0x[0-9a-fA-F]+)%"}},
+    {State::FLT,      std::regex{R"%(^-?[0-9]+\.[0-9]*[eE]-?[0-9]+)%"}},
+    {State::FLT,      std::regex{R"%(^-?[0-9]+\.[0-9]+)%"}},
+    {State::FLT,      std::regex{R"%(^-?[0-9]+\.)%"}},
+    {State::FLT,      std::regex{R"%(^-?\.[0-9]+[eE]-?[0-9]+)%"}},
+    {State::FLT,      std::regex{R"%(^-?\.[0-9]+)%"}},
+    {State::DEC,      std::regex{R"%(^-?[0-9]+)%"}},
+    {State::IDENT,    std::regex{R"%(^[a-zA-Z~!@$%^&*_+=|:<>?/]+[a-zA-Z0-9~!@$%^&*_+=|:<>.?/-]*)%"}},
+    {State::STRING,   std::regex{R"%(^"([^\\"]|\\([abftvrn"\\]|x([0-9a-fA-F][0-9a-fA-F])))*")%"}},
+  });
+
+  const std::vector<std::pair<State::Token, std::string>> strings({
+    {State::LIST_START, "("},
+    {State::LIST_END,   ")"},
+    {State::CONS_START, "'("},
+    {State::BOOL,       "true"},
+    {State::BOOL,       "false"},
+  });
+
+  bool is_space(char c)
+  {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+  }
+
+  std::pair<State::Token, std::string> token(const char *buffer, size_t len, size_t& index)
+  {
+    std::pair<State::Token, std::string> out{State::EOI, ""};
+
+    if (index < len)
+    {
+      out.first = State::UNKNOWN;
+
+      for (; index < len && is_space(buffer[index]); index++)
+      {}
+
+      const char *str{&buffer[index]};
+      for (auto& p : strings)
+      {
+        if (strncmp(p.second.c_str(), str, p.second.size()) == 0)
+        {
+          out = p;
+          break;
+        }
+      }
+
+      if (out.first == State::UNKNOWN)
+      {
+        for (auto& p : regexes)
+        {
+          std::cmatch m;
+          if (std::regex_search(str, m, p.second))
+          {
+            out.first = p.first;
+            out.second = m.str(0);
+            break;
+          }
+        }
+      }
+      index += out.second.size();
+
+      for (; index < len && is_space(buffer[index]); index++)
+      {}
+    }
+
+    return out;
+  }
+}
+
+std::string corpus(size_t size)
+{
+  const std::string forms[]{
+    "(module asdf:fdsa)\n",
+    "(+ 1 -1 0b101 -0o17 0x1F 3/4 -3/-4)\n",
+    "(protocol witty-comeback () :respond)\n",
+    "(witty-comeback no-u\n  (:respond (lambda () \"no, u\")))\n",
+    "'(a 'b 'c '\\n' '\\x41' true false truest)\n",
+    "(floats 1. 1.5 -2.25e-3 .5 -.5e10 3.14159e-200)\n",
+    "(\"escaped \\\"string\\\" \\x41\\n\" 'sym-bol? <=>)\n",
+  };
+
+  std::string out;
+  out.reserve(size + 64);
+  for (size_t i = 0; out.size() < size; i++)
+  {
+    out += forms[i % (sizeof(forms) / sizeof(forms[0]))];
+  }
+  return out;
+}
+
+// Lists of integers in every base, floats and rationals. Also returns the
+// sum of the integers so the conversions can be checked.
+std::string numeric_corpus(size_t size, int64_t& sum)
+{
+  const char *formats[]{"%lld", "-%lld", "0x%llx", "-0o%llo", "%lld.%03lld", "-%lld/%lld", "%lld.5e-%lld"};
+  uint64_t x{0x9e3779b97f4a7c15};
+  char buf[64];
+
+  std::string out;
+  out.reserve(size + 64);
+  sum = 0;
+  for (size_t i = 0; out.size() < size; i++)
+  {
+    out += i % 16 == 0 ? "(" : " ";
+    x = x * 6364136223846793005 + 1442695040888963407;
+    long long n{static_cast<long long>(x >> 40)};
+    size_t f{i % (sizeof(formats) / sizeof(formats[0]))};
+    snprintf(buf, sizeof(buf), formats[f], n, n % 200 + 1);
+    out += buf;
+    sum += f == 0 || f == 2 ? n : f == 1 || f == 3 ? -n : 0;
+    out += i % 16 == 15 ? ")\n" : "";
+  }
+  out += out.back() == '\n' ? "" : ")\n";
+  return out;
+}
+
+template <typename F>
+double seconds(F f)
+{
+  auto start{std::chrono::steady_clock::now()};
+  f();
+  std::chrono::duration<double> d{std::chrono::steady_clock::now() - start};
+  return d.count();
+}
+
+void report(const std::string& name, size_t bytes, size_t count, const std::string& unit, double secs)
+{
+  std::cout << name << ": " << count << " " << unit << ", " << secs << " s, "
+    << (bytes / secs / (1024 * 1024)) << " MB/s" << std::endl;
+}
+
+std::vector<std::pair<State::Token, std::string>> lex_all(const std::string& data)
+{
+  std::vector<std::pair<State::Token, std::string>> out;
+  State s{State::from_string(data)};
+  std::pair<State::Token, std::string_view> tkn;
+  while ((tkn = s.token()).first != State::EOI && tkn.first != State::UNKNOWN)
+  {
+    out.emplace_back(tkn.first, tkn.second);
+  }
+  return out;
+}
+
+// The regex scanner is quadratic in the input size, so it only gets a small
+// corpus; the DFA output is checked against it on that same corpus.
+bool bench_lexer(const std::string& data, const std::string& small)
+{
+  std::vector<std::pair<State::Token, std::string>> before, after;
+
+  double t_before{seconds([&]() {
+    size_t index{0};
+    std::pair<State::Token, std::string> tkn;
+    while ((tkn = legacy::token(small.c_str(), small.size(), index)).first != State::EOI &&
+           tkn.first != State::UNKNOWN)
+    {
+      before.push_back(tkn);
+    }
+  })};
+  report("lexer (regex)", small.size(), before.size(), "tokens", t_before);
+
+  bool eq{before == lex_all(small)};
+  if (!eq)
+  {
+    std::cout << "lexer: token streams differ" << std::endl;
+  }
+
+  double t_after{seconds([&]() {
+    after = lex_all(data);
+  })};
+  report("lexer (dfa)", data.size(), after.size(), "tokens", t_after);
+
+  return eq;
+}
+
+// Each Scan kernel over one long run of the bytes it skips, at every level
+// this CPU supports.
+bool bench_scan(size_t size)
+{
+  struct Kernel
+  {
+    const char *name;
+    size_t (*scan)(const char *, size_t, size_t);
+    std::string data;
+  };
+  Kernel kernels[]{
+    {"whitespace", Scan::whitespace, std::string(size, ' ')},
+    {"string body", Scan::string_body, std::string(size, 'a')},
+    {"name", Scan::name, std::string(size, 'a')},
+  };
+  for (size_t i = 0; i < size; i += 7)
+  {
+    kernels[0].data[i] = "\t\n\r "[i % 4];
+    kernels[1].data[i] = "( )'x;"[i % 6];
+    kernels[2].data[i] = "-?.!9Z"[i % 6];
+  }
+
+  const size_t rounds{20};
+  bool ok{true};
+  for (int level = Scan::SCALAR; level <= Scan::best(); level++)
+  {
+    Scan::use(static_cast<Scan::Level>(level));
+    for (auto& k : kernels)
+    {
+      size_t end{0};
+      double t{seconds([&]() {
+        for (size_t r = 0; r < rounds; r++)
+        {
+          end = k.scan(k.data.data(), 0, k.data.size());
+        }
+      })};
+      ok = ok && end == k.data.size();
+      report(std::string("scan ") + k.name + " (" + Scan::level_to_string(Scan::current()) + ")",
+             k.data.size() * rounds, k.data.size(), "bytes", t);
+    }
+  }
+  Scan::use(Scan::best());
+
+  if (!ok)
+  {
+    std::cout << "scan: a kernel stopped early" << std::endl;
+  }
+  return ok;
+}
+
+bool bench_parser(const std::string& data)
+{
+  File f;
+  State s{State::from_string(data)};
+  size_t throws_before{throw_count};
+  size_t allocs_before{alloc_count};
+
+  double t{seconds([&]() {
+    f.parse(s);
+  })};
+  size_t throws{throw_count - throws_before};
+  size_t allocs{alloc_count - allocs_before};
+
+  report("parser", data.size(), f.exprs.size(), "forms", t);
+  std::cout << "parser: " << throws << " exceptions on valid input" << std::endl;
+  std::cout << "parser: " << allocs << " heap allocations for " << f.arena.allocations
+    << " arena objects (" << f.arena.blocks << " blocks, " << f.arena.bytes << " bytes)" << std::endl;
+
+  Pool pool;
+  File p;
+  State ps{State::from_string(data)};
+  double t_pool{seconds([&]() {
+    p.parse(ps, pool);
+  })};
+  report("parser (" + std::to_string(pool.size()) + " threads)", data.size(), p.exprs.size(), "forms", t_pool);
+  bool eq{p == f};
+  if (!eq)
+  {
+    std::cout << "parser: parallel tree differs" << std::endl;
+  }
+
+  throws_before = throw_count;
+  try
+  {
+    File bad;
+    State b{State::from_string(data + "(unbalanced")};
+    bad.parse(b);
+  }
+  catch (std::runtime_error&)
+  {}
+  std::cout << "parser: " << (throw_count - throws_before) << " exceptions on invalid input" << std::endl;
+
+  return throws == 0 && eq;
+}
+
+// Number conversion on its own, over a corpus that is nearly all numbers.
+bool bench_numbers(size_t size)
+{
+  int64_t expected;
+  std::string data{numeric_corpus(size, expected)};
+  File f;
+  State s{State::from_string(data)};
+  size_t allocs_before{alloc_count};
+
+  double t{seconds([&]() {
+    f.parse(s);
+  })};
+  size_t allocs{alloc_count - allocs_before};
+
+  size_t count{0};
+  int64_t sum{0};
+  for (auto& v : f.exprs)
+  {
+    for (auto& n : v.l->val)
+    {
+      count++;
+      sum += n.a->n.kind == Number::N ? n.a->n.i : 0;
+    }
+  }
+  report("numbers", data.size(), count, "numbers", t);
+  std::cout << "numbers: " << allocs << " heap allocations for " << f.arena.blocks << " arena blocks" << std::endl;
+
+  bool eq{sum == expected};
+  if (!eq)
+  {
+    std::cout << "numbers: integers converted wrong" << std::endl;
+  }
+  return eq;
+}
+
+// One small edit in the middle of the corpus, as an editor would make on
+// a keystroke: reparsing must match a full parse of the edited text.
+bool bench_reparse(const std::string& data)
+{
+  File f, g;
+  State s{State::from_string(data)};
+  f.parse(s);
+
+  size_t offset{data.find('(', data.size() / 2) + 1};
+  std::string edited{data};
+  edited.insert(offset, "edit ");
+  State e{State::from_string(edited)};
+
+  double t_full{seconds([&]() {
+    g.parse(e);
+  })};
+  report("reparse (full)", edited.size(), g.exprs.size(), "forms", t_full);
+
+  double t_edit{seconds([&]() {
+    f.reparse(State::from_string(edited), offset, 0, 5);
+  })};
+  report("reparse (edit)", edited.size(), f.exprs.size(), "forms", t_edit);
+
+  bool eq{f == g && f.spans == g.spans};
+  if (!eq)
+  {
+    std::cout << "reparse: tree differs from a full parse" << std::endl;
+  }
+  return eq;
+}
+
+// Loading a saved tree against parsing the text again; the load includes
+// hashing the text to check the cache still matches.
+bool bench_cache(const std::string& data)
+{
+  File f;
+  State s{State::from_string(data)};
+  double t_parse{seconds([&]() {
+    f.parse(s);
+  })};
+  report("cache (parse)", data.size(), f.exprs.size(), "forms", t_parse);
+
+  std::string path{AstCache::path("/tmp/lang-bench", data)};
+  bool ok{AstCache::save(path, f, data)};
+  std::unique_ptr<const AstCache> cache;
+  double t_load{seconds([&]() {
+    cache = AstCache::load(path, data);
+  })};
+  ok = ok && cache && cache->roots == f.exprs.size();
+  report("cache (load)", data.size(), cache ? cache->roots : 0, "forms", t_load);
+  ok = ok && cache->print() == f.print();
+  remove(path.c_str());
+
+  if (!ok)
+  {
+    std::cout << "cache: loaded tree differs" << std::endl;
+  }
+  return ok;
+}
+
+// Dumping a parsed tree: through the ostream operators as print() used
+// to, and through a Printer, both into memory and onto /dev/null.
+bool bench_dump(const std::string& data)
+{
+  File f;
+  State s{State::from_string(data)};
+  f.parse(s);
+
+  std::string before;
+  double t_stream{seconds([&]() {
+    std::stringstream ss;
+    ss << f;
+    before = ss.str();
+  })};
+  report("dump (ostream)", before.size(), f.exprs.size(), "forms", t_stream);
+
+  std::string after;
+  size_t allocs_before{alloc_count};
+  double t_printer{seconds([&]() {
+    Printer p{-1, 2 * before.size()};
+    after = p.print(f).str();
+  })};
+  size_t allocs{alloc_count - allocs_before};
+  report("dump (printer)", after.size(), f.exprs.size(), "forms", t_printer);
+
+  int fd{open("/dev/null", O_WRONLY | O_CLOEXEC)};
+  double t_write{seconds([&]() {
+    Printer p{fd};
+    p.print(f);
+  })};
+  close(fd);
+  report("dump (write)", after.size(), f.exprs.size(), "forms", t_write);
+  std::cout << "dump: " << allocs << " heap allocations in memory" << std::endl;
+
+  bool eq{before == after};
+  if (!eq)
+  {
+    std::cout << "dump: printer output differs" << std::endl;
+  }
+  return eq;
+}
+
+// Counts top-level forms and the lists headed by an identifier through
+// Events, which must agree with the tree and allocate nothing per form.
+bool bench_events(const std::string& data)
+{
+  struct Heads : Events
+  {
+    void on_list_start(bool, std::string_view) override
+    {
+      if (depth++ == 0)
+      {
+        forms++;
+      }
+      head = true;
+    }
+
+    void on_list_end(std::string_view) override
+    {
+      depth--;
+      head = false;
+    }
+
+    void on_atom(State::Token kind, std::string_view) override
+    {
+      forms += depth == 0;
+      heads += head && kind == State::IDENT;
+      head = false;
+    }
+
+    size_t depth{0};
+    size_t forms{0};
+    size_t heads{0};
+    bool head{false};
+  } events;
+
+  State s{State::from_string(data)};
+  size_t allocs_before{alloc_count};
+  double t{seconds([&]() {
+    events.parse(s);
+  })};
+  size_t allocs{alloc_count - allocs_before};
+  report("events", data.size(), events.forms, "forms", t);
+  std::cout << "events: " << events.heads << " lists headed by an identifier, "
+    << allocs << " heap allocations" << std::endl;
+
+  File f;
+  State fs{State::from_string(data)};
+  f.parse(fs);
+  bool eq{events.forms == f.exprs.size()};
+  if (!eq)
+  {
+    std::cout << "events: form count differs from the tree" << std::endl;
+  }
+  return eq;
+}
+
+// Lexes once into a tape, then parses from it; the tree must match the one
+// parsed straight from the State.
+bool bench_tape(const std::string& data)
+{
+  State s{State::from_string(data)};
+  Tape tape;
+  File f, g;
+
+  double t_lex{seconds([&]() {
+    tape = Tape::lex(s);
+  })};
+  report("tape lex", data.size(), tape.size(), "tokens", t_lex);
+  std::cout << "tape: " << (sizeof(State::Token) + 2 * sizeof(uint32_t)) * tape.size()
+    << " bytes for " << tape.size() << " tokens" << std::endl;
+
+  double t_parse{seconds([&]() {
+    f.parse(tape);
+  })};
+  report("tape parse", data.size(), f.exprs.size(), "forms", t_parse);
+
+  g.parse(s);
+  bool eq{f == g};
+  if (!eq)
+  {
+    std::cout << "tape: tree differs from the direct parse" << std::endl;
+  }
+  return eq;
+}
+
+// astdump -t output of a lexed tape to /dev/null: the old ostream lines
+// flushed one by one, buffered text lines and binary records, next to the
+// lex alone.
+bool bench_tokens(const std::string& data)
+{
+  State s{State::from_string(data)};
+  Tape tape;
+  int fd{open("/dev/null", O_WRONLY | O_CLOEXEC)};
+
+  double t_lex{seconds([&]() {
+    tape = Tape::lex(s);
+  })};
+  report("tokens lex", data.size(), tape.size(), "tokens", t_lex);
+
+  double t_stream{seconds([&]() {
+    std::ofstream out{"/dev/null"};
+    for (size_t i = 0; i < tape.size(); i++)
+    {
+      out << State::token_to_string(tape.kinds[i]) << ":" << tape.text(i) << std::endl;
+    }
+  })};
+  report("tokens (ostream)", data.size(), tape.size(), "tokens", t_stream);
+
+  bool ok{true};
+  double t_text{seconds([&]() {
+    Printer p{fd};
+    ok = p.print(tape).flush();
+  })};
+  report("tokens (text)", data.size(), tape.size(), "tokens", t_text);
+
+  double t_binary{seconds([&]() {
+    Printer p{fd};
+    ok = p.records(tape).flush() && ok;
+  })};
+  report("tokens (binary)", data.size(), tape.size(), "tokens", t_binary);
+  close(fd);
+
+  std::cout << "tokens: " << Printer().print(tape).str().size() << " bytes as text, " << 13 * tape.size()
+    << " as records" << std::endl;
+  if (!ok)
+  {
+    std::cout << "tokens: write failed" << std::endl;
+  }
+  return ok;
+}
+
+// Parallel lexing and parsing from 1 to 32 threads. Pieces are sized so
+// every thread gets several even on the default corpus.
+bool bench_scaling(const std::string& data)
+{
+  State s{State::from_string(data)};
+  State es{State::from_string(data)};
+  Tape serial{Tape::lex(s)};
+  File expected;
+  expected.parse(es);
+  bool ok{true};
+
+  for (size_t threads = 1; threads <= 32; threads *= 2)
+  {
+    Pool pool{threads};
+    size_t chunk{data.size() / (threads * 4) + 1};
+    Tape tape;
+    File f;
+    State ps{State::from_string(data)};
+
+    double t_lex{seconds([&]() {
+      tape = Tape::lex(s, pool, chunk);
+    })};
+    double t_parse{seconds([&]() {
+      f.parse(ps, pool, chunk);
+    })};
+    report("tape lex (" + std::to_string(threads) + " threads)", data.size(), tape.size(), "tokens", t_lex);
+    report("parser (" + std::to_string(threads) + " threads)", data.size(), f.exprs.size(), "forms", t_parse);
+
+    ok = ok && tape.kinds == serial.kinds && tape.offsets == serial.offsets &&
+      tape.lengths == serial.lengths && f == expected;
+  }
+
+  if (!ok)
+  {
+    std::cout << "scaling: parallel output differs from serial" << std::endl;
+  }
+  return ok;
+}
+
+size_t walk(const Value& v)
+{
+  size_t out{0};
+
+  if (v.kind == Value::L)
+  {
+    for (auto& i : v.l->val)
+    {
+      out += walk(i);
+    }
+  }
+  else if (v.a->kind == Atom::ID || v.a->kind == Atom::SY)
+  {
+    out = 1;
+  }
+  else if (v.a->kind == Atom::ST)
+  {
+    out = v.a->s->val.size();
+  }
+
+  return out;
+}
+
+bool bench_flat(const std::string& data)
+{
+  File f, g;
+  State s{State::from_string(data)};
+  State t{State::from_string(data)};
+  f.parse(s);
+  g.parse(t);
+  FlatFile ff{f}, fg{g};
+  const size_t rounds{10};
+
+  size_t tree_bytes{0}, flat_bytes{0};
+  double t_tree{seconds([&]() {
+    for (size_t r = 0; r < rounds; r++)
+    {
+      for (auto& v : f.exprs)
+      {
+        tree_bytes += walk(v);
+      }
+    }
+  })};
+  double t_flat{seconds([&]() {
+    for (size_t r = 0; r < rounds; r++)
+    {
+      for (auto& n : ff.nodes)
+      {
+        if (n.kind == FlatFile::IDENT || n.kind == FlatFile::SYMBOL)
+        {
+          flat_bytes++;
+        }
+        else if (n.kind == FlatFile::STRING)
+        {
+          flat_bytes += n.count;
+        }
+      }
+    }
+  })};
+  std::cout << "walk (tree): " << t_tree / rounds << " s" << std::endl;
+  std::cout << "walk (flat): " << t_flat / rounds << " s, " << ff.nodes.size() << " nodes" << std::endl;
+
+  bool eq_tree{false}, eq_flat{false};
+  double t_eq_tree{seconds([&]() {
+    for (size_t r = 0; r < rounds; r++)
+    {
+      eq_tree = f == g;
+    }
+  })};
+  double t_eq_flat{seconds([&]() {
+    for (size_t r = 0; r < rounds; r++)
+    {
+      eq_flat = ff == fg;
+    }
+  })};
+  std::cout << "equality (tree): " << t_eq_tree / rounds << " s" << std::endl;
+  std::cout << "equality (flat): " << t_eq_flat / rounds << " s" << std::endl;
+
+  bool ok{tree_bytes == flat_bytes && eq_tree && eq_flat && ff == f && ff.print() == f.print()};
+  if (!ok)
+  {
+    std::cout << "flat: does not match the tree" << std::endl;
+  }
+  return ok;
+}
+
+int main(int argc, char **argv)
+{
+  size_t size{4 * 1024 * 1024};
+  size_t regex_size{4 * 1024};
+  if (argc > 1)
+  {
+    size = std::stoull(argv[1]);
+  }
+  if (argc > 2)
+  {
+    regex_size = std::stoull(argv[2]);
+  }
+
+  std::string data{corpus(size)};
+  std::string small{corpus(regex_size)};
+  std::cout << "corpus: " << data.size() << " bytes" << std::endl;
+
+  bool ok{bench_scan(size)};
+  ok = bench_lexer(data, small) && ok;
+  ok = bench_parser(data) && ok;
+  ok = bench_events(data) && ok;
+  ok = bench_numbers(size) && ok;
+  ok = bench_reparse(data) && ok;
+  ok = bench_cache(data) && ok;
+  ok = bench_dump(data) && ok;
+  ok = bench_tape(data) && ok;
+  ok = bench_tokens(data) && ok;
+  ok = bench_scaling(data) && ok;
+  ok = bench_flat(data) && ok;
+
+  return ok ? 0 : 1;
+}
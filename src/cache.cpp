@@ -0,0 +1,314 @@
+#include <parser.h>
+
+#include <atomic>
+#include <cstring>
+#include <fcntl.h>
+#include <fstream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace lang::parser {
+  using namespace lang::parser;
+
+  namespace {
+    // Sections follow the header in this order, each a multiple of 8
+    // bytes until the two character pools at the end:
+    //   nodes         FlatFile::Node[nodes]
+    //   spans         uint64_t[2 * roots], start and end of every form
+    //   name offsets  uint64_t[names + 1] into the name bytes
+    //   strings       char[strings]
+    //   name bytes    char[name_bytes]
+    struct Header
+    {
+      char magic[8];
+      uint32_t version;
+      uint32_t order;       // reads back differently on the other byte order
+      uint64_t node_size;
+      uint64_t hash;
+      uint64_t source_size;
+      uint64_t nodes;
+      uint64_t roots;
+      uint64_t strings;
+      uint64_t names;
+      uint64_t name_bytes;
+    };
+
+    const char magic[8]{'L', 'A', 'N', 'G', 'A', 'S', 'T', '\0'};
+    const uint32_t version{1};
+    const uint32_t order{0x01020304};
+
+    size_t total_size(const Header& h)
+    {
+      return sizeof(Header) + h.nodes * sizeof(FlatFile::Node) + 2 * h.roots * sizeof(uint64_t) +
+        (h.names + 1) * sizeof(uint64_t) + h.strings + h.name_bytes;
+    }
+
+    // Whether every index in the sections stays inside them, so a stale
+    // or corrupted cache of the right size cannot be read out of bounds.
+    // Children always come after their list, which also rules out cycles.
+    bool valid(const Header& h, const char *map, size_t size)
+    {
+      bool ok{h.nodes <= size && h.roots <= h.nodes && h.names <= size && h.strings <= size &&
+              h.name_bytes <= size && total_size(h) == size};
+      const char *p{map + sizeof(Header)};
+      const FlatFile::Node *nodes{reinterpret_cast<const FlatFile::Node*>(p)};
+      const uint64_t *spans{reinterpret_cast<const uint64_t*>(p += ok ? h.nodes * sizeof(FlatFile::Node) : 0)};
+      const uint64_t *name_offsets{reinterpret_cast<const uint64_t*>(p += ok ? 2 * h.roots * sizeof(uint64_t) : 0)};
+      // Children are laid out breadth first, so each list's must start
+      // where the one before it ended. That makes the nodes a tree: no two
+      // lists share a child and every node but the roots has a parent.
+      uint64_t next{h.roots};
+
+      for (size_t i = 0; ok && i < h.nodes; i++)
+      {
+        const FlatFile::Node& n{nodes[i]};
+        switch (n.kind)
+        {
+        case FlatFile::LIST:
+        case FlatFile::CONS:
+          ok = n.first > i && n.first == next && n.count <= h.nodes - next;
+          next += ok ? n.count : 0;
+          break;
+        case FlatFile::STRING:
+          ok = n.offset <= h.strings && n.count <= h.strings - n.offset;
+          break;
+        case FlatFile::IDENT:
+        case FlatFile::SYMBOL:
+          ok = n.id < h.names;
+          break;
+        case FlatFile::INT:
+        case FlatFile::FLT:
+        case FlatFile::RAT:
+        case FlatFile::CHAR:
+          break;
+        case FlatFile::BOOL:
+          // Saved from a zeroed node, so the whole word is 0 or 1; reading
+          // `b` itself would be undefined for any other byte.
+          ok = n.first <= 1;
+          break;
+        default:
+          ok = false;
+        }
+      }
+      ok = ok && next == h.nodes;
+      for (size_t r = 0; ok && r < h.roots; r++)
+      {
+        ok = spans[2 * r] <= spans[2 * r + 1] && spans[2 * r + 1] <= h.source_size;
+      }
+      ok = ok && name_offsets[0] == 0 && name_offsets[h.names] == h.name_bytes;
+      for (size_t k = 0; ok && k < h.names; k++)
+      {
+        ok = name_offsets[k] <= name_offsets[k + 1];
+      }
+
+      return ok;
+    }
+  }
+
+  // Mixes a word at a time and finishes with the MurmurHash3 finalizer, so
+  // hashing a source costs little next to parsing it.
+  uint64_t AstCache::hash(std::string_view text)
+  {
+    const uint64_t k{0x9e3779b97f4a7c15};
+    uint64_t h{text.size() * k};
+    size_t i{0};
+
+    for (; i + 8 <= text.size(); i += 8)
+    {
+      uint64_t w;
+      memcpy(&w, text.data() + i, 8);
+      h = ((h << 5 | h >> 59) ^ w) * k;
+    }
+    for (; i < text.size(); i++)
+    {
+      h = ((h << 5 | h >> 59) ^ static_cast<unsigned char>(text[i])) * k;
+    }
+
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccd;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53;
+    h ^= h >> 33;
+    return h;
+  }
+
+  std::string AstCache::path(const std::string& source, std::string_view text, const std::string& dir)
+  {
+    std::string out{source + ".ast"};
+
+    if (!dir.empty())
+    {
+      char buf[17];
+      snprintf(buf, sizeof(buf), "%016llx", static_cast<unsigned long long>(hash(text)));
+      out = dir + "/" + buf + ".ast";
+    }
+
+    return out;
+  }
+
+  // Names are renumbered in order of first use, so the cache does not
+  // depend on the ids this process happened to give them.
+  bool AstCache::save(const std::string& path, const File& file, std::string_view text)
+  {
+    return save(path, FlatFile{file}, file.spans, text);
+  }
+
+  bool AstCache::save(const std::string& path, FlatFile flat, const std::vector<std::pair<size_t, size_t>>& spans,
+                      std::string_view text)
+  {
+    std::unordered_map<uint32_t, uint64_t> local;
+    std::vector<uint64_t> name_offsets{0};
+    std::string name_bytes;
+
+    for (auto& n : flat.nodes)
+    {
+      if (n.kind == FlatFile::IDENT || n.kind == FlatFile::SYMBOL)
+      {
+        auto it{local.find(n.id)};
+        if (it == local.end())
+        {
+          it = local.emplace(n.id, local.size()).first;
+          name_bytes += Names::name(n.id);
+          name_offsets.push_back(name_bytes.size());
+        }
+        n.id = it->second;
+      }
+    }
+
+    std::vector<uint64_t> bounds;
+    for (auto& s : spans)
+    {
+      bounds.push_back(s.first);
+      bounds.push_back(s.second);
+    }
+    bounds.resize(2 * flat.roots);
+
+    Header h{};
+    memcpy(h.magic, magic, sizeof(magic));
+    h.version = version;
+    h.order = order;
+    h.node_size = sizeof(FlatFile::Node);
+    h.hash = hash(text);
+    h.source_size = text.size();
+    h.nodes = flat.nodes.size();
+    h.roots = flat.roots;
+    h.strings = flat.strings.size();
+    h.names = local.size();
+    h.name_bytes = name_bytes.size();
+
+    // Written aside under a name no other process or thread is using, then
+    // renamed into place, so a reader never maps half a cache.
+    static std::atomic<uint64_t> saves{0};
+    std::string tmp{path + "." + std::to_string(getpid()) + "." + std::to_string(saves++) + ".tmp"};
+    bool ok;
+    {
+      std::ofstream out{tmp, std::ios::binary | std::ios::trunc};
+      out.write(reinterpret_cast<const char*>(&h), sizeof(h));
+      out.write(reinterpret_cast<const char*>(flat.nodes.data()), flat.nodes.size() * sizeof(FlatFile::Node));
+      out.write(reinterpret_cast<const char*>(bounds.data()), bounds.size() * sizeof(uint64_t));
+      out.write(reinterpret_cast<const char*>(name_offsets.data()), name_offsets.size() * sizeof(uint64_t));
+      out.write(flat.strings.data(), flat.strings.size());
+      out.write(name_bytes.data(), name_bytes.size());
+      out.close();
+      ok = static_cast<bool>(out);
+    }
+
+    ok = ok && rename(tmp.c_str(), path.c_str()) == 0;
+    if (!ok)
+    {
+      unlink(tmp.c_str());
+    }
+    return ok;
+  }
+
+  std::unique_ptr<const AstCache> AstCache::load(const std::string& path, std::string_view text)
+  {
+    std::unique_ptr<const AstCache> out;
+    int fd{open(path.c_str(), O_RDONLY | O_CLOEXEC)};
+
+    if (fd >= 0)
+    {
+      struct stat st;
+      void *map{MAP_FAILED};
+
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && static_cast<size_t>(st.st_size) >= sizeof(Header))
+      {
+        map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      }
+      close(fd);
+
+      if (map != MAP_FAILED)
+      {
+        const Header& h{*static_cast<const Header*>(map)};
+        bool ok{memcmp(h.magic, magic, sizeof(magic)) == 0 && h.version == version && h.order == order &&
+                h.node_size == sizeof(FlatFile::Node) && h.source_size == text.size() &&
+                h.hash == hash(text) && valid(h, static_cast<const char*>(map), st.st_size)};
+
+        if (ok)
+        {
+          out.reset(new AstCache(map, st.st_size));
+        }
+        else
+        {
+          munmap(map, st.st_size);
+        }
+      }
+    }
+
+    return out;
+  }
+
+  AstCache::AstCache(const void *map_, size_t map_size_)
+    : nodes()
+    , size()
+    , roots()
+    , map(map_)
+    , map_size(map_size_)
+    , spans()
+    , name_offsets()
+    , name_bytes()
+    , strings()
+  {
+    const Header& h{*static_cast<const Header*>(map)};
+    const char *p{static_cast<const char*>(map) + sizeof(Header)};
+
+    nodes = reinterpret_cast<const FlatFile::Node*>(p);
+    size = h.nodes;
+    roots = h.roots;
+    p += h.nodes * sizeof(FlatFile::Node);
+    spans = reinterpret_cast<const uint64_t*>(p);
+    p += 2 * h.roots * sizeof(uint64_t);
+    name_offsets = reinterpret_cast<const uint64_t*>(p);
+    p += (h.names + 1) * sizeof(uint64_t);
+    strings = std::string_view(p, h.strings);
+    name_bytes = p + h.strings;
+  }
+
+  AstCache::~AstCache()
+  {
+    munmap(const_cast<void*>(map), map_size);
+  }
+
+  std::string_view AstCache::text(const FlatFile::Node& n) const
+  {
+    std::string_view out;
+
+    if (n.kind == FlatFile::STRING)
+    {
+      out = strings.substr(n.offset, n.count);
+    }
+    else if (n.kind == FlatFile::IDENT || n.kind == FlatFile::SYMBOL)
+    {
+      out = std::string_view(name_bytes + name_offsets[n.id], name_offsets[n.id + 1] - name_offsets[n.id]);
+    }
+
+    return out;
+  }
+
+  std::pair<size_t, size_t> AstCache::span(size_t root) const
+  {
+    return {spans[2 * root], spans[2 * root + 1]};
+  }
+}
@@ -0,0 +1,448 @@
+#include <parser.h>
+
+
+namespace lang::parser {
+  using namespace lang::parser;
+
+  FlatFile::FlatFile()
+    : nodes()
+    , strings()
+    , roots(0)
+    , levels()
+  {}
+
+  namespace {
+    // The node of an atom, with a string's text appended to `strings`.
+    FlatFile::Node flat_atom(const Atom& a, std::string& strings)
+    {
+      FlatFile::Node n{};
+      std::string_view str;
+
+      switch (a.kind)
+      {
+      case Atom::NU:
+        switch (a.n.kind)
+        {
+        case Number::N:
+          n.kind = FlatFile::INT;
+          n.i = a.n.i;
+          break;
+        case Number::F:
+          n.kind = FlatFile::FLT;
+          n.d = a.n.d;
+          break;
+        case Number::R:
+          n.kind = FlatFile::RAT;
+          n.i = a.n.r.first;
+          n.den = a.n.r.second;
+          break;
+        }
+        break;
+      case Atom::CH:
+        n.kind = FlatFile::CHAR;
+        n.c = a.c.val;
+        break;
+      case Atom::BL:
+        n.kind = FlatFile::BOOL;
+        n.b = a.b.val;
+        break;
+      case Atom::ST:
+        n.kind = FlatFile::STRING;
+        str = a.s->val;
+        break;
+      case Atom::ID:
+        n.kind = FlatFile::IDENT;
+        n.id = a.i->id;
+        break;
+      case Atom::SY:
+        n.kind = FlatFile::SYMBOL;
+        n.id = a.sy->id;
+        break;
+      }
+
+      if (n.kind == FlatFile::STRING)
+      {
+        n.offset = strings.size();
+        n.count = str.size();
+        strings.append(str);
+      }
+
+      return n;
+    }
+  }
+
+  // Lists are laid out breadth first: when a list is placed, room for all of
+  // its children is reserved at the end of `nodes`, and the children are
+  // filled in once the lists queued before it are done.
+  FlatFile::FlatFile(const File& file)
+    : nodes(file.exprs.size())
+    , strings()
+    , roots(file.exprs.size())
+    , levels()
+  {
+    struct Run
+    {
+      const Value *items;
+      size_t count;
+      size_t first;
+    };
+    std::vector<Run> runs{{file.exprs.data(), file.exprs.size(), 0}};
+
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+      Run run{runs[r]};
+
+      for (size_t k = 0; k < run.count; k++)
+      {
+        const Value& v{run.items[k]};
+        Node n{};
+
+        if (v.kind == Value::L)
+        {
+          n.kind = v.l->is_cons ? CONS : LIST;
+          n.count = v.l->val.size();
+          n.first = nodes.size();
+          runs.push_back({v.l->val.data, v.l->val.size(), nodes.size()});
+          nodes.resize(nodes.size() + n.count);
+        }
+        else
+        {
+          n = flat_atom(*v.a, strings);
+        }
+
+        nodes[run.first + k] = n;
+      }
+    }
+  }
+
+  // The breadth-first order of many forms is their roots, then the nodes
+  // one level down in each form in turn, and so on. So each form's nodes
+  // are appended to the level they sit at, with a list's `first` counted
+  // within the next level until finish() knows where each level starts.
+  void FlatFile::add(const Value& form)
+  {
+    struct Run
+    {
+      const Value *items;
+      size_t count;
+      size_t level;
+      size_t first;
+    };
+
+    if (levels.empty())
+    {
+      levels.emplace_back();
+    }
+    std::vector<Run> runs{{&form, 1, 0, levels[0].size()}};
+    levels[0].emplace_back();
+
+    for (size_t r = 0; r < runs.size(); r++)
+    {
+      Run run{runs[r]};
+
+      for (size_t k = 0; k < run.count; k++)
+      {
+        const Value& v{run.items[k]};
+        Node n{};
+
+        if (v.kind == Value::L)
+        {
+          if (levels.size() < run.level + 2)
+          {
+            levels.emplace_back();
+          }
+          std::vector<Node>& below{levels[run.level + 1]};
+          n.kind = v.l->is_cons ? CONS : LIST;
+          n.count = v.l->val.size();
+          n.first = below.size();
+          runs.push_back({v.l->val.data, v.l->val.size(), run.level + 1, below.size()});
+          below.resize(below.size() + n.count);
+        }
+        else
+        {
+          n = flat_atom(*v.a, strings);
+        }
+
+        levels[run.level][run.first + k] = n;
+      }
+    }
+  }
+
+  void FlatFile::finish()
+  {
+    std::vector<size_t> starts{0};
+    for (auto& level : levels)
+    {
+      starts.push_back(starts.back() + level.size());
+    }
+    roots = levels.empty() ? 0 : levels[0].size();
+    nodes.clear();
+    nodes.reserve(starts.back());
+
+    for (size_t l = 0; l < levels.size(); l++)
+    {
+      for (Node n : levels[l])
+      {
+        if (n.kind == LIST || n.kind == CONS)
+        {
+          n.first += starts[l + 1];
+        }
+        nodes.push_back(n);
+      }
+    }
+    levels.clear();
+  }
+
+  FlatValue FlatFile::root(size_t i) const
+  {
+    return FlatValue{this, i};
+  }
+
+  std::string_view FlatFile::text(const Node& n) const
+  {
+    std::string_view out;
+
+    if (n.kind == STRING)
+    {
+      out = std::string_view(strings.data() + n.offset, n.count);
+    }
+    else if (n.kind == IDENT || n.kind == SYMBOL)
+    {
+      out = Names::name(n.id);
+    }
+
+    return out;
+  }
+
+  std::string FlatFile::print() const
+  {
+    Printer p;
+    p.print(*this);
+    return std::string(p.str());
+  }
+
+  namespace {
+    bool same_atom(const FlatFile& f, const FlatFile::Node& n, const FlatFile& g, const FlatFile::Node& m)
+    {
+      bool eq{n.kind == m.kind};
+
+      if (eq)
+      {
+        switch (n.kind)
+        {
+        case FlatFile::LIST:
+        case FlatFile::CONS:
+          eq = n.count == m.count;
+          break;
+        case FlatFile::INT:
+          eq = n.i == m.i;
+          break;
+        case FlatFile::FLT:
+          eq = n.d == m.d;
+          break;
+        case FlatFile::RAT:
+          eq = n.i == m.i && n.den == m.den;
+          break;
+        case FlatFile::CHAR:
+          eq = n.c == m.c;
+          break;
+        case FlatFile::BOOL:
+          eq = n.b == m.b;
+          break;
+        case FlatFile::STRING:
+          eq = f.text(n) == g.text(m);
+          break;
+        case FlatFile::IDENT:
+        case FlatFile::SYMBOL:
+          eq = n.id == m.id;
+          break;
+        }
+      }
+
+      return eq;
+    }
+
+    // Builds the pointer-tree atom a flat node stands for, so printing goes
+    // through exactly the same operator<< as the tree. `F` is a FlatFile or
+    // an AstCache.
+    template <typename F>
+    Atom to_atom(const F& f, const FlatFile::Node& n, String& s, Ident& i, Symbol& sy)
+    {
+      Atom a;
+
+      switch (n.kind)
+      {
+      case FlatFile::INT:
+        a.kind = Atom::NU;
+        a.n.kind = Number::N;
+        a.n.i = n.i;
+        break;
+      case FlatFile::FLT:
+        a.kind = Atom::NU;
+        a.n.kind = Number::F;
+        a.n.d = n.d;
+        break;
+      case FlatFile::RAT:
+        a.kind = Atom::NU;
+        a.n.kind = Number::R;
+        a.n.r = {n.i, n.den};
+        break;
+      case FlatFile::CHAR:
+        a.kind = Atom::CH;
+        a.c.val = n.c;
+        break;
+      case FlatFile::BOOL:
+        a.kind = Atom::BL;
+        a.b.val = n.b;
+        break;
+      case FlatFile::STRING:
+        s.val = f.text(n);
+        a.kind = Atom::ST;
+        a.s = &s;
+        break;
+      case FlatFile::IDENT:
+        i.id = n.id;
+        i.val = f.text(n);
+        a.kind = Atom::ID;
+        a.i = &i;
+        break;
+      default:
+        sy.id = n.id;
+        sy.val = f.text(n);
+        a.kind = Atom::SY;
+        a.sy = &sy;
+      }
+
+      return a;
+    }
+
+    template <typename F>
+    void print_node(std::ostream& os, const F& f, size_t index)
+    {
+      const FlatFile::Node& n{f.nodes[index]};
+
+      os << "V(";
+      if (n.kind == FlatFile::LIST || n.kind == FlatFile::CONS)
+      {
+        os << "L( ";
+        for (size_t i = 0; i < n.count; i++)
+        {
+          print_node(os, f, n.first + i);
+          os << " ";
+        }
+        os << ")";
+      }
+      else
+      {
+        String s;
+        Ident id;
+        Symbol sy;
+        os << to_atom(f, n, s, id, sy);
+      }
+      os << ")";
+    }
+  }
+
+  // Equal trees produce identical layouts, so whole files compare with one
+  // pass over the node arrays.
+  bool FlatFile::operator==(const FlatFile& item) const
+  {
+    bool eq{roots == item.roots && nodes.size() == item.nodes.size()};
+
+    for (size_t i = 0; eq && i < nodes.size(); i++)
+    {
+      eq = same_atom(*this, nodes[i], item, item.nodes[i]);
+    }
+
+    return eq;
+  }
+
+  bool FlatFile::operator==(const File& item) const
+  {
+    bool eq{roots == item.exprs.size()};
+
+    for (size_t i = 0; eq && i < roots; i++)
+    {
+      eq = root(i) == item.exprs[i];
+    }
+
+    return eq;
+  }
+
+  std::ostream& operator<<(std::ostream& os, const FlatFile& item)
+  {
+    os << "File(";
+    for (size_t i = 0; i < item.roots; i++)
+    {
+      os << item.root(i);
+    }
+    os << ")";
+    return os;
+  }
+
+  bool FlatValue::operator==(const FlatValue& item) const
+  {
+    const FlatFile::Node& n{file->nodes[index]};
+    const FlatFile::Node& m{item.file->nodes[item.index]};
+    bool eq{same_atom(*file, n, *item.file, m)};
+
+    if (eq && (n.kind == FlatFile::LIST || n.kind == FlatFile::CONS))
+    {
+      for (size_t i = 0; eq && i < n.count; i++)
+      {
+        eq = FlatValue{file, n.first + i} == FlatValue{item.file, m.first + i};
+      }
+    }
+
+    return eq;
+  }
+
+  bool FlatValue::operator==(const Value& item) const
+  {
+    const FlatFile::Node& n{file->nodes[index]};
+    bool eq;
+
+    if (n.kind == FlatFile::LIST || n.kind == FlatFile::CONS)
+    {
+      eq = item.kind == Value::L && item.l && (n.kind == FlatFile::CONS) == item.l->is_cons &&
+        n.count == item.l->val.size();
+      for (size_t i = 0; eq && i < n.count; i++)
+      {
+        eq = FlatValue{file, n.first + i} == item.l->val[i];
+      }
+    }
+    else
+    {
+      String s;
+      Ident id;
+      Symbol sy;
+      eq = item.kind == Value::A && item.a && to_atom(*file, n, s, id, sy) == *item.a;
+    }
+
+    return eq;
+  }
+
+  std::ostream& operator<<(std::ostream& os, const FlatValue& item)
+  {
+    print_node(os, *item.file, item.index);
+    return os;
+  }
+
+  std::string AstCache::print() const
+  {
+    Printer p;
+    p.print(*this);
+    return std::string(p.str());
+  }
+
+  std::ostream& operator<<(std::ostream& os, const AstCache& item)
+  {
+    os << "File(";
+    for (size_t i = 0; i < item.roots; i++)
+    {
+      print_node(os, item, i);
+    }
+    os << ")";
+    return os;
+  }
+}
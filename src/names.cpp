@@ -0,0 +1,85 @@
+#include <parser.h>
+
+#include <mutex>
+#include <shared_mutex>
+#include <unordered_map>
+
+namespace lang::parser {
+  using namespace lang::parser;
+
+  namespace {
+    struct NameTable
+    {
+      std::shared_mutex lock;
+      std::unordered_map<std::string_view, uint32_t> ids;
+      std::vector<std::string_view> names;
+      Arena storage;
+    };
+
+    NameTable& table()
+    {
+      static NameTable t;
+      return t;
+    }
+
+    // Names this thread has already seen, so the hot path of a parse takes
+    // no lock. Keys point at the interned copies.
+    thread_local std::unordered_map<std::string_view, uint32_t> seen;
+  }
+
+  std::pair<uint32_t, std::string_view> Names::intern(std::string_view name)
+  {
+    auto it{seen.find(name)};
+
+    if (it == seen.end())
+    {
+      NameTable& t{table()};
+      std::pair<uint32_t, std::string_view> out;
+      bool found{false};
+
+      {
+        std::shared_lock<std::shared_mutex> read{t.lock};
+        auto global{t.ids.find(name)};
+        if (global != t.ids.end())
+        {
+          out = {global->second, global->first};
+          found = true;
+        }
+      }
+
+      if (!found)
+      {
+        std::unique_lock<std::shared_mutex> write{t.lock};
+        auto global{t.ids.find(name)};
+        if (global != t.ids.end())
+        {
+          out = {global->second, global->first};
+        }
+        else
+        {
+          out = {static_cast<uint32_t>(t.names.size()), t.storage.copy(name)};
+          t.names.push_back(out.second);
+          t.ids.emplace(out.second, out.first);
+        }
+      }
+
+      it = seen.emplace(out.second, out.first).first;
+    }
+
+    return {it->second, it->first};
+  }
+
+  std::string_view Names::name(uint32_t id)
+  {
+    NameTable& t{table()};
+    std::shared_lock<std::shared_mutex> read{t.lock};
+    return id < t.names.size() ? t.names[id] : std::string_view();
+  }
+
+  size_t Names::size()
+  {
+    NameTable& t{table()};
+    std::shared_lock<std::shared_mutex> read{t.lock};
+    return t.names.size();
+  }
+}
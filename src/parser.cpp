@@ -1,127 +1,326 @@
 #include <parser.h>
 
-#include <regex>
+#include <cerrno>
 #include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <charconv>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 #include <utility>
-#include <fstream>
+#include <tuple>
 #include <iostream>
-#include <sstream>
 
 namespace lang::parser {
   using namespace lang::parser;
 
-  State State::from_file(const std::string& filename)
+  Source::Source(const std::string& filename_, std::string&& data_, Origin origin_)
+    : filename(filename_)
+    , origin(origin_)
+    , data(std::move(data_))
+    , map(0)
+    , map_size(0)
+    , lines_once()
+    , line_starts()
+  {}
+
+  Source::Source(const std::string& filename_, const void *map_, size_t map_size_)
+    : filename(filename_)
+    , origin{0, 0, 0}
+    , data()
+    , map(map_)
+    , map_size(map_size_)
+    , lines_once()
+    , line_starts()
+  {}
+
+  Source::~Source()
   {
-    State s;
-    std::ifstream f;
-    f.open(filename);
+    if (map)
+    {
+      munmap(const_cast<void*>(map), map_size);
+    }
+  }
 
-    if (f.is_open())
+  const char *Source::buffer() const
+  {
+    return map ? static_cast<const char*>(map) : data.c_str();
+  }
+
+  size_t Source::size() const
+  {
+    return map ? map_size : data.size();
+  }
+
+  namespace {
+    // Appends the offset just past every newline in `buffer`, 16 bytes at a
+    // time where SSE2 is available.
+    void find_newlines(const char *buffer, size_t len, std::vector<size_t>& out)
     {
-      std::string data;
-      f.seekg(0, std::ios::end);
-      data.reserve(f.tellg());
-      f.seekg(0, std::ios::beg);
-      data.assign(
-        std::istreambuf_iterator<char>(f),
-        std::istreambuf_iterator<char>());
-      f.close();
-      std::cout << data << std::endl;
-      s.len = data.size();
-      char *tmp = new char[s.len + 1];
-      strncpy(tmp, data.c_str(), s.len);
-      tmp[s.len] = 0;
-      s.filename = filename;
-      s.buffer = tmp;
-      s.index = 0;
-      s.lineno = 0;
-      s.column = 0;
+      size_t i{0};
+
+#if defined(__SSE2__)
+      const __m128i nl{_mm_set1_epi8('\n')};
+      for (; i + 16 <= len; i += 16)
+      {
+        __m128i chunk{_mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + i))};
+        unsigned mask{static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(chunk, nl)))};
+        for (; mask; mask &= mask - 1)
+        {
+          out.push_back(i + __builtin_ctz(mask) + 1);
+        }
+      }
+#endif
+
+      for (const char *p; i < len && (p = static_cast<const char*>(memchr(buffer + i, '\n', len - i))); )
+      {
+        i = p - buffer + 1;
+        out.push_back(i);
+      }
     }
+  }
 
-    return s;
+  std::pair<size_t, size_t> Source::position(size_t offset) const
+  {
+    std::call_once(lines_once, [this]() {
+      line_starts.push_back(0);
+      find_newlines(buffer(), size(), line_starts);
+    });
+
+    size_t line{static_cast<size_t>(std::upper_bound(line_starts.begin(), line_starts.end(), offset) -
+                                    line_starts.begin()) - 1};
+    return {origin.line + line, offset - line_starts[line] + (line == 0 ? origin.column : 0)};
+  }
+
+  namespace {
+    // Reads whatever `fd` yields until end of file; used for pipes, terminals
+    // and anything else that cannot be mapped.
+    bool read_all(int fd, std::string& out)
+    {
+      char buf[64 * 1024];
+      ssize_t n;
+
+      while ((n = read(fd, buf, sizeof(buf))) != 0)
+      {
+        if (n < 0 && errno != EINTR)
+        {
+          return false;
+        }
+        else if (n > 0)
+        {
+          out.append(buf, n);
+        }
+      }
+
+      return true;
+    }
   }
-  State State::from_string(const std::string& data)
+
+  // Regular files are mapped read-only and lexed in place, so the text is
+  // never copied. Anything else is read into a string.
+  State State::from_file(const std::string& filename)
   {
     State s;
+    int fd{open(filename.c_str(), O_RDONLY | O_CLOEXEC)};
 
-    if (data.size() > 0)
+    if (fd >= 0)
     {
-      s.len = data.size();
-      char *tmp = new char[s.len + 1];
-      strncpy(tmp, data.c_str(), s.len);
-      tmp[s.len] = 0;
-      s.buffer = tmp;
-      s.index = 0;
-      s.lineno = 0;
-      s.column = 0;
+      struct stat st;
+      void *map{MAP_FAILED};
+
+      if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0)
+      {
+        map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+      }
+
+      std::string data;
+      if (map != MAP_FAILED)
+      {
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+        s = State(std::make_shared<const Source>(filename, map, st.st_size));
+      }
+      else if (read_all(fd, data))
+      {
+        s = State(std::make_shared<const Source>(filename, std::move(data)));
+      }
+
+      close(fd);
     }
 
     return s;
   }
 
+  State State::from_string(const std::string& data, const std::string& filename)
+  {
+    return State(std::make_shared<const Source>(filename, std::string(data)));
+  }
+
   State::State()
-    : filename()
+    : source()
+    , arena(0)
     , buffer(0)
     , len(0)
     , index(0)
-    , lineno(0)
-    , column(0)
+    , max_depth(SIZE_MAX)
     , quiet(true)
   {}
 
-  State::State(const State& s)
+  State::State(std::shared_ptr<const Source> source_)
+    : source(std::move(source_))
+    , arena(0)
+    , buffer(source->buffer())
+    , len(source->size())
+    , index(0)
+    , max_depth(SIZE_MAX)
+    , quiet(true)
+  {}
+
+  const std::string& State::filename() const
+  {
+    static const std::string none;
+    return source ? source->filename : none;
+  }
+
+  struct Arena::Block
+  {
+    Block *next;
+  };
+
+  namespace {
+    const size_t arena_block_size{64 * 1024};
+  }
+
+  Arena::Arena()
+    : blocks(0)
+    , allocations(0)
+    , bytes(0)
+    , copies(0)
+    , head(0)
+    , cur(0)
+    , end(0)
+  {}
+
+  Arena::Arena(Arena&& a) noexcept
+    : Arena()
   {
-    *this = s;
+    *this = std::move(a);
   }
 
-  State::State(State&& s)
+  Arena::~Arena()
   {
-    *this = s;
+    release();
   }
 
-  State::~State()
+  Arena& Arena::operator=(Arena&& a) noexcept
   {
-    if (buffer && len > 0)
+    if (this != &a)
     {
-      delete buffer;
-      buffer = 0;
-      len = 0;
-      index = 0;
-      lineno = 0;
-      column = 0;
+      release();
+      std::swap(blocks, a.blocks);
+      std::swap(allocations, a.allocations);
+      std::swap(bytes, a.bytes);
+      std::swap(copies, a.copies);
+      std::swap(head, a.head);
+      std::swap(cur, a.cur);
+      std::swap(end, a.end);
     }
+    return *this;
   }
 
-  State& State::operator=(const State& s)
+  void *Arena::allocate(size_t size, size_t align)
   {
-    filename = s.filename;
-    len = s.len;
-    index = s.index;
-    lineno = s.lineno;
-    column = s.column;
-    char *tmp = new char[len + 1];
-    strncpy(tmp, s.buffer, len);
-    tmp[len] = 0;
-    buffer = tmp;
+    uintptr_t p{(reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(align - 1)};
 
-    return *this;
+    if (!cur || p + size > reinterpret_cast<uintptr_t>(end))
+    {
+      // Blocks grow to 1MB so big files need few of them; oversized
+      // requests get a block of their own.
+      size_t block_size{std::max(arena_block_size << std::min<size_t>(blocks, 4),
+                                 sizeof(Block) + size + align)};
+      Block *b{static_cast<Block*>(::operator new(block_size))};
+      b->next = head;
+      head = b;
+      blocks++;
+      cur = reinterpret_cast<char*>(b + 1);
+      end = reinterpret_cast<char*>(b) + block_size;
+      p = (reinterpret_cast<uintptr_t>(cur) + align - 1) & ~(align - 1);
+    }
+
+    cur = reinterpret_cast<char*>(p + size);
+    allocations++;
+    bytes += size;
+    return reinterpret_cast<void*>(p);
   }
 
-  State& State::operator=(State&& s)
+  std::string_view Arena::copy(std::string_view str)
   {
-    filename = s.filename;
-    buffer = s.buffer;
-    len = s.len;
-    index = s.index;
-    lineno = s.lineno;
-    column = s.column;
-    s.buffer = 0;
-    s.len = 0;
-    s.index = 0;
-    s.lineno = 0;
-    s.column = 0;
+    std::string_view out;
 
-    return *this;
+    if (str.size() > 0)
+    {
+      char *data{static_cast<char*>(allocate(str.size(), 1))};
+      memcpy(data, str.data(), str.size());
+      out = std::string_view(data, str.size());
+    }
+
+    return out;
+  }
+
+  void Arena::absorb(Arena&& a)
+  {
+    if (a.head)
+    {
+      Block *tail{a.head};
+      for (; tail->next; tail = tail->next)
+      {}
+      tail->next = head;
+      head = a.head;
+      blocks += a.blocks;
+      allocations += a.allocations;
+      bytes += a.bytes;
+      copies += a.copies;
+
+      // Our own current block keeps serving allocations; a's is dropped.
+      a.head = 0;
+      a.release();
+    }
+  }
+
+  void Arena::release()
+  {
+    while (head)
+    {
+      Block *next{head->next};
+      ::operator delete(head);
+      head = next;
+    }
+    blocks = 0;
+    allocations = 0;
+    bytes = 0;
+    copies = 0;
+    cur = 0;
+    end = 0;
+  }
+
+  void Arena::reset()
+  {
+    Block *keep{head};
+    char *keep_end{end};
+    head = keep ? keep->next : nullptr;
+    release();
+
+    if (keep)
+    {
+      keep->next = nullptr;
+      head = keep;
+      blocks = 1;
+      cur = reinterpret_cast<char*>(keep + 1);
+      end = keep_end;
+    }
   }
 
   size_t State::remaining_len() const
@@ -134,229 +333,750 @@ namespace lang::parser {
     return (bool)buffer && remaining_len() > 0;
   }
 
+  std::string State::describe(const std::string& msg) const
+  {
+    char buf[512];
+    // A mapped source has no terminator to read at the end of input.
+    char c{index < len ? buffer[index] : '\0'};
+    snprintf(buf, sizeof(buf), "%s at %s:%zu:%zu char '%c'", msg.c_str(), filename().c_str(), lineno() + 1, column() + 1, c);
+    return buf;
+  }
+
   void State::fail(const std::string& msg) const
   {
-    const size_t len{512};
-    char buf[len];
-    int end = snprintf(buf, len, "%s at %s:%zu:%zu char '%c'", msg.c_str(), filename.c_str(), lineno + 1, column + 1, buffer[index]);
-    buf[end] = 0;
-    throw std::runtime_error(buf);
-  }
-
-  const std::vector<std::pair<State::Token, std::regex>> regexes({
-    std::pair<State::Token, std::regex>{
-      State::CHAR,       std::regex{R"%(^'([^\\]|\\([abftvrn'\\]|(x([0-9a-fA-F]{2}))))')%"}},
-    std::pair<State::Token, std::regex>{
-      State::SYMBOL,     std::regex{R"%(^'[a-zA-Z~!@$%^&*_+=|:<>?/]+[a-zA-Z0-9~!@$%^&*_+=|:<>.?/-]*)%"}},
-    std::pair<State::Token, std::regex>{
-      State::RATIONAL,   std::regex{R"%(^-?[0-9]+/-?[0-9]+)%"}},
-    std::pair<State::Token, std::regex>{
-      State::BIN,        std::regex{R"%(^-?0b[01]+)%"}},
-    std::pair<State::Token, std::regex>{
-      State::OCT,        std::regex{R"%(^-?0o[0-7]+)%"}},
-    std::pair<State::Token, std::regex>{
-      State::HEX,        std::regex{R"%(^-?0x[0-9a-fA-F]+)%"}},
-    std::pair<State::Token, std::regex>{
-      State::FLT,        std::regex{R"%(^-?[0-9]+\.[0-9]*[eE]-?[0-9]+)%"}},
-    std::pair<State::Token, std::regex>{
-      State::FLT,        std::regex{R"%(^-?[0-9]+\.[0-9]+)%"}},
-    std::pair<State::Token, std::regex>{
-      State::FLT,        std::regex{R"%(^-?[0-9]+\.)%"}},
-    std::pair<State::Token, std::regex>{
-      State::FLT,        std::regex{R"%(^-?\.[0-9]+[eE]-?[0-9]+)%"}},
-    std::pair<State::Token, std::regex>{
-      State::FLT,        std::regex{R"%(^-?\.[0-9]+)%"}},
-    std::pair<State::Token, std::regex>{
-      State::DEC,        std::regex{R"%(^-?[0-9]+)%"}},
-    std::pair<State::Token, std::regex>{
-      State::IDENT,      std::regex{R"%(^[a-zA-Z~!@$%^&*_+=|:<>?/]+[a-zA-Z0-9~!@$%^&*_+=|:<>.?/-]*)%"}},
-    std::pair<State::Token, std::regex>{
-      State::STRING,     std::regex{R"%(^"([^\\"]|\\([abftvrn"\\]|x([0-9a-fA-F][0-9a-fA-F])))*")%"}},
-  });
-
-  static const std::vector<std::pair<State::Token, std::string>> strings({
-    std::pair<State::Token, std::string>{
-      State::LIST_START, std::string{"("}},
-    std::pair<State::Token, std::string>{
-      State::LIST_END,   std::string{")"}},
-    std::pair<State::Token, std::string>{
-      State::CONS_START, std::string{"'("}},
-    std::pair<State::Token, std::string>{
-      State::BOOL,       std::string{"true"}},
-    std::pair<State::Token, std::string>{
-      State::BOOL,       std::string{"false"}},
-  });
-
-  std::pair<State::Token, std::string> State::token()
-  {
-    std::pair<Token, std::string> out{EOI, ""};
+    throw std::runtime_error(describe(msg));
+  }
 
-    if (*this)
+  namespace {
+    // States of the lexer DFA. L_DEAD must stay zero: a zeroed transition
+    // means the current token cannot be extended any further.
+    enum Lex : uint8_t
+    {
+      L_DEAD,
+      L_START,
+      L_OPEN,
+      L_CLOSE,
+      L_QUOTE,
+      L_CONS,
+      L_SYM_1,      // 'c where c may start a symbol or be a char
+      L_SYM,
+      L_CHR_1,      // 'c where c can only be a char
+      L_CHR_ESC,
+      L_CHR_X1,
+      L_CHR_X2,
+      L_CHR_ESC_END,
+      L_CHR,
+      L_STR_BODY,
+      L_STR_ESC,
+      L_STR_X1,
+      L_STR_X2,
+      L_STR,
+      L_ID,
+      L_T,
+      L_TR,
+      L_TRU,
+      L_TRUE,
+      L_F,
+      L_FA,
+      L_FAL,
+      L_FALS,
+      L_FALSE,
+      L_MINUS,
+      L_ZERO,
+      L_INT,
+      L_BIN_PFX,
+      L_BIN,
+      L_OCT_PFX,
+      L_OCT,
+      L_HEX_PFX,
+      L_HEX,
+      L_RAT_SLASH,
+      L_RAT_MINUS,
+      L_RAT,
+      L_FLT_DOT,    // 1.
+      L_FLT_FRAC,   // 1.5
+      L_DOT,        // . or -.
+      L_DOT_FRAC,   // .5
+      L_EXP,
+      L_EXP_MINUS,
+      L_EXP_DIGITS,
+      L_COUNT
+    };
+
+    const char *ident_start{
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ~!@$%^&*_+=|:<>?/"};
+    const char *ident_rest{"0123456789.-"};
+    const char *digits{"0123456789"};
+    const char *hex_digits{"0123456789abcdefABCDEF"};
+
+    struct Dfa
     {
-      out.first = UNKNOWN;
+      Dfa();
 
-      for (char c{buffer[index]};
-           *this && (c == ' ' || c == '\t' || c == '\n' || c == '\r');
-           bump(), c = buffer[index])
-      {}
+      void on(Lex from, const char *chars, Lex to);
+      void on_any(Lex from, Lex to);
+      void on_ident(Lex from, Lex to);
+
+      uint8_t next[L_COUNT][256];
+      State::Token accept[L_COUNT];
+      bool extends[L_COUNT];    // some byte leads out of the state
+    };
 
-      const char *str{&buffer[index]};
-      for (auto& p : strings)
+    void Dfa::on(Lex from, const char *chars, Lex to)
+    {
+      for (; *chars; chars++)
       {
-        if (strncmp(p.second.c_str(), str, p.second.size()) == 0)
+        next[from][static_cast<unsigned char>(*chars)] = to;
+      }
+    }
+
+    void Dfa::on_any(Lex from, Lex to)
+    {
+      // NUL never belongs to a token.
+      for (size_t c = 1; c < 256; c++)
+      {
+        next[from][c] = to;
+      }
+    }
+
+    void Dfa::on_ident(Lex from, Lex to)
+    {
+      on(from, ident_start, to);
+      on(from, ident_rest, to);
+    }
+
+    // Mirrors the old regex table: fixed strings ("(", ")", "'(", "true",
+    // "false") win even when a longer token could be matched, everything
+    // else is longest match.
+    Dfa::Dfa()
+    {
+      memset(next, L_DEAD, sizeof(next));
+      for (auto& a : accept)
+      {
+        a = State::UNKNOWN;
+      }
+
+      on(L_START, "(", L_OPEN);
+      on(L_START, ")", L_CLOSE);
+      on(L_START, "'", L_QUOTE);
+      on(L_START, "\"", L_STR_BODY);
+      on(L_START, ident_start, L_ID);
+      on(L_START, "t", L_T);
+      on(L_START, "f", L_F);
+      on(L_START, "-", L_MINUS);
+      on(L_START, "0", L_ZERO);
+      on(L_START, "123456789", L_INT);
+      on(L_START, ".", L_DOT);
+
+      on_any(L_QUOTE, L_CHR_1);
+      on(L_QUOTE, ident_start, L_SYM_1);
+      on(L_QUOTE, "(", L_CONS);
+      on(L_QUOTE, "\\", L_CHR_ESC);
+      on(L_SYM_1, "'", L_CHR);
+      on_ident(L_SYM_1, L_SYM);
+      on_ident(L_SYM, L_SYM);
+      on(L_CHR_1, "'", L_CHR);
+      on(L_CHR_ESC, "abftvrn'\\", L_CHR_ESC_END);
+      on(L_CHR_ESC, "x", L_CHR_X1);
+      on(L_CHR_X1, hex_digits, L_CHR_X2);
+      on(L_CHR_X2, hex_digits, L_CHR_ESC_END);
+      on(L_CHR_ESC_END, "'", L_CHR);
+
+      on_any(L_STR_BODY, L_STR_BODY);
+      on(L_STR_BODY, "\"", L_STR);
+      on(L_STR_BODY, "\\", L_STR_ESC);
+      on(L_STR_ESC, "abftvrn\"\\", L_STR_BODY);
+      on(L_STR_ESC, "x", L_STR_X1);
+      on(L_STR_X1, hex_digits, L_STR_X2);
+      on(L_STR_X2, hex_digits, L_STR_BODY);
+
+      const Lex bool_prefixes[]{L_ID, L_T, L_TR, L_TRU, L_F, L_FA, L_FAL, L_FALS};
+      for (Lex l : bool_prefixes)
+      {
+        on_ident(l, L_ID);
+      }
+      on(L_T, "r", L_TR);
+      on(L_TR, "u", L_TRU);
+      on(L_TRU, "e", L_TRUE);
+      on(L_F, "a", L_FA);
+      on(L_FA, "l", L_FAL);
+      on(L_FAL, "s", L_FALS);
+      on(L_FALS, "e", L_FALSE);
+
+      on(L_MINUS, "0", L_ZERO);
+      on(L_MINUS, "123456789", L_INT);
+      on(L_MINUS, ".", L_DOT);
+      on(L_ZERO, digits, L_INT);
+      on(L_ZERO, "b", L_BIN_PFX);
+      on(L_ZERO, "o", L_OCT_PFX);
+      on(L_ZERO, "x", L_HEX_PFX);
+      on(L_BIN_PFX, "01", L_BIN);
+      on(L_BIN, "01", L_BIN);
+      on(L_OCT_PFX, "01234567", L_OCT);
+      on(L_OCT, "01234567", L_OCT);
+      on(L_HEX_PFX, hex_digits, L_HEX);
+      on(L_HEX, hex_digits, L_HEX);
+
+      for (Lex l : {L_ZERO, L_INT})
+      {
+        on(l, "/", L_RAT_SLASH);
+        on(l, ".", L_FLT_DOT);
+      }
+      on(L_INT, digits, L_INT);
+      on(L_RAT_SLASH, "-", L_RAT_MINUS);
+      on(L_RAT_SLASH, digits, L_RAT);
+      on(L_RAT_MINUS, digits, L_RAT);
+      on(L_RAT, digits, L_RAT);
+
+      on(L_FLT_DOT, digits, L_FLT_FRAC);
+      on(L_FLT_FRAC, digits, L_FLT_FRAC);
+      on(L_DOT, digits, L_DOT_FRAC);
+      on(L_DOT_FRAC, digits, L_DOT_FRAC);
+      for (Lex l : {L_FLT_DOT, L_FLT_FRAC, L_DOT_FRAC})
+      {
+        on(l, "eE", L_EXP);
+      }
+      on(L_EXP, "-", L_EXP_MINUS);
+      on(L_EXP, digits, L_EXP_DIGITS);
+      on(L_EXP_MINUS, digits, L_EXP_DIGITS);
+      on(L_EXP_DIGITS, digits, L_EXP_DIGITS);
+
+      accept[L_OPEN] = State::LIST_START;
+      accept[L_CLOSE] = State::LIST_END;
+      accept[L_CONS] = State::CONS_START;
+      accept[L_SYM_1] = State::SYMBOL;
+      accept[L_SYM] = State::SYMBOL;
+      accept[L_CHR] = State::CHAR;
+      accept[L_STR] = State::STRING;
+      for (Lex l : bool_prefixes)
+      {
+        accept[l] = State::IDENT;
+      }
+      accept[L_TRUE] = State::BOOL;
+      accept[L_FALSE] = State::BOOL;
+      accept[L_ZERO] = State::DEC;
+      accept[L_INT] = State::DEC;
+      accept[L_BIN] = State::BIN;
+      accept[L_OCT] = State::OCT;
+      accept[L_HEX] = State::HEX;
+      accept[L_RAT] = State::RATIONAL;
+      accept[L_FLT_DOT] = State::FLT;
+      accept[L_FLT_FRAC] = State::FLT;
+      accept[L_DOT_FRAC] = State::FLT;
+      accept[L_EXP_DIGITS] = State::FLT;
+
+      for (size_t l = 0; l < L_COUNT; l++)
+      {
+        extends[l] = false;
+        for (size_t c = 0; c < 256; c++)
         {
-          out.first = p.first;
-          out.second = p.second;
-          bump(out.second.size());
-          break;
+          extends[l] = extends[l] || next[l][c] != L_DEAD;
         }
       }
+    }
 
-      if (out.first == UNKNOWN)
+    const Dfa dfa;
+
+    // Most runs of whitespace, name or string bytes are shorter than this;
+    // they are cheaper to step through than to hand to a Scan kernel.
+    const size_t long_run{16};
+
+    // Runs the DFA from `from` for as long as the token can grow and returns
+    // where it stopped. `l` is left at the last state reached, `t` and `end`
+    // describe the longest token seen. Long runs of name or string body
+    // bytes, which loop on a single state, are skipped with Scan kernels.
+    size_t munch(const char *buffer, size_t from, size_t len, uint8_t& l, State::Token& t, size_t& end)
+    {
+      size_t i{from};
+      size_t run{0};
+      uint8_t prev{L_START};
+      l = L_START;
+      t = State::UNKNOWN;
+      end = from;
+
+      for (; i < len && (l = dfa.next[l][static_cast<unsigned char>(buffer[i])]) != L_DEAD; prev = l, i++)
       {
-        for (auto& p : regexes)
+        run = l == prev ? run + 1 : 0;
+        if (run == long_run)
         {
-          std::cmatch m;
-          if (std::regex_search(str, m, p.second))
+          if (l == L_ID || l == L_SYM)
           {
-            out.first = p.first;
-            out.second = m.str(0);
-            bump(out.second.size());
-
-            break;
+            i = Scan::name(buffer, i + 1, len) - 1;
           }
+          else if (l == L_STR_BODY)
+          {
+            i = Scan::string_body(buffer, i + 1, len) - 1;
+          }
+        }
+
+        if (dfa.accept[l] != State::UNKNOWN)
+        {
+          t = dfa.accept[l];
+          end = i + 1;
         }
       }
 
-      for (char c{buffer[index]};
-           *this && (c == ' ' || c == '\t' || c == '\n' || c == '\r');
-           bump(), c = buffer[index])
-      {}
+      return i;
+    }
+  }
+
+  std::pair<State::Token, std::string_view> State::token()
+  {
+    std::pair<Token, std::string_view> out{EOI, {}};
+
+    skip_whitespace();
+    if (*this)
+    {
+      size_t end;
+      uint8_t l;
+      munch(buffer, index, len, l, out.first, end);
+
+      if (out.first != UNKNOWN)
+      {
+        out.second = std::string_view(&buffer[index], end - index);
+        bump(end - index);
+      }
+
+      skip_whitespace();
     }
 
     return out;
   }
 
+  Stream::Stream(int fd_, const std::string& filename_, size_t chunk_size_)
+    : fd(fd_)
+    , filename(filename_)
+    , chunk_size(chunk_size_)
+    , pending()
+    , scanned(0)
+    , complete(0)
+    , depth(0)
+    , eof(false)
+    , broken(false)
+    , origin{0, 0, 0}
+  {}
 
-  void State::bump(size_t len_)
+  State Stream::next()
   {
-    if (*this && len_ > 0)
+    while (complete == 0 && !eof)
     {
-      const size_t new_idx{index + len_};
+      size_t old{pending.size()};
+      pending.resize(old + chunk_size);
+      ssize_t n{read(fd, &pending[old], chunk_size)};
+      pending.resize(old + std::max<ssize_t>(n, 0));
 
-      for (index++; *this && index < new_idx; index++)
+      if (n == 0 || (n < 0 && errno != EINTR))
       {
-        char c = buffer[index];
-        if (c == '\n')
+        eof = true;
+      }
+      else if (n > 0)
+      {
+        scan();
+      }
+    }
+
+    State out;
+    size_t take{eof ? pending.size() : complete};
+
+    if (take > 0)
+    {
+      out = State(std::make_shared<const Source>(filename, pending.substr(0, take), origin));
+
+      size_t last{pending.rfind('\n', take - 1)};
+      origin.offset += take;
+      origin.line += std::count(pending.begin(), pending.begin() + take, '\n');
+      origin.column = last == std::string::npos ? origin.column + take : take - last - 1;
+
+      pending.erase(0, take);
+      scanned -= std::min(scanned, take);
+      complete = 0;
+    }
+
+    return out;
+  }
+
+  // Moves `scanned` over every token of `pending` that more input could not
+  // change, and `complete` to the end of the last top-level form among
+  // them. A token running into the end of the data may still grow, so it is
+  // left for after the next read. Anything the lexer rejects is handed out
+  // as it is, so the parser reports the error.
+  void Stream::scan()
+  {
+    const char *buffer{pending.data()};
+    size_t len{pending.size()};
+
+    while (!broken && (scanned = Scan::whitespace(buffer, scanned, len)) < len)
+    {
+      size_t end;
+      uint8_t l;
+      State::Token t;
+      size_t i{munch(buffer, scanned, len, l, t, end)};
+
+      if (i == len && dfa.extends[l])
+      {
+        break;
+      }
+      else if (t == State::UNKNOWN || (t == State::LIST_END && depth == 0))
+      {
+        broken = true;
+      }
+      else
+      {
+        depth += (t == State::LIST_START || t == State::CONS_START);
+        depth -= (t == State::LIST_END);
+        scanned = end;
+        if (depth == 0)
         {
-          column = 0;
-          lineno++;
+          complete = scanned;
         }
-        else if (c != '\r')
+      }
+    }
+
+    if (broken)
+    {
+      complete = len;
+    }
+  }
+
+  Tape Tape::lex(const State& state)
+  {
+    Tape out;
+    State st{state};
+
+    if (st.len > UINT32_MAX)
+    {
+      st.fail("Input too large for a token tape");
+    }
+
+    // Tokens in real code average a few bytes; this saves most regrowth.
+    size_t guess{st.remaining_len() / 4};
+    out.kinds.reserve(guess);
+    out.offsets.reserve(guess);
+    out.lengths.reserve(guess);
+
+    std::pair<State::Token, std::string_view> tkn;
+    while ((tkn = st.token()).first != State::EOI && tkn.first != State::UNKNOWN)
+    {
+      out.kinds.push_back(tkn.first);
+      out.offsets.push_back(tkn.second.data() - st.buffer);
+      out.lengths.push_back(tkn.second.size());
+    }
+
+    out.state = state;
+    out.end = st.index;
+    return out;
+  }
+
+  namespace {
+    // Tokens lexed speculatively from a guessed start. `resume` is where
+    // lexing would carry on: the start of the first token past the piece,
+    // or where the input ended or stopped lexing.
+    struct Piece
+    {
+      std::vector<State::Token> kinds;
+      std::vector<uint32_t> offsets;
+      std::vector<uint32_t> lengths;
+      size_t resume;
+    };
+
+    void append(Tape& out, const Piece& p, size_t from)
+    {
+      out.kinds.insert(out.kinds.end(), p.kinds.begin() + from, p.kinds.end());
+      out.offsets.insert(out.offsets.end(), p.offsets.begin() + from, p.offsets.end());
+      out.lengths.insert(out.lengths.end(), p.lengths.begin() + from, p.lengths.end());
+    }
+  }
+
+  // Every piece after the first guesses that a token starts on the first
+  // line beginning inside it, i.e. that the cut is not inside a string or
+  // char spanning lines. Lexing from a token start does not depend on
+  // anything before it, so once the serial position lands on a token
+  // start a piece found, the rest of that piece is exactly what serial
+  // lexing would give. The seams are walked in order, and only tokens
+  // between the serial position and such a meeting point are lexed again.
+  Tape Tape::lex(const State& state, Pool& pool, size_t chunk)
+  {
+    size_t count{std::min<size_t>(pool.size() * 4, state.remaining_len() / std::max<size_t>(chunk, 1))};
+
+    if (count < 2 || pool.size() < 2)
+    {
+      return lex(state);
+    }
+    else if (state.len > UINT32_MAX)
+    {
+      state.fail("Input too large for a token tape");
+    }
+
+    std::vector<size_t> cuts(count + 1);
+    for (size_t k = 0; k <= count; k++)
+    {
+      cuts[k] = state.index + state.remaining_len() * k / count;
+    }
+
+    std::vector<Piece> pieces(count);
+    pool.run(count, [&](size_t k, size_t) {
+      Piece& p{pieces[k]};
+      State st{state};
+
+      if (k > 0)
+      {
+        const void *nl{memchr(state.buffer + cuts[k], '\n', cuts[k + 1] - cuts[k])};
+        st.index = nl ? static_cast<const char*>(nl) - state.buffer + 1 : cuts[k];
+      }
+
+      std::pair<State::Token, std::string_view> tkn;
+      p.resume = state.len;
+      while ((tkn = st.token()).first != State::EOI)
+      {
+        size_t offset{static_cast<size_t>(tkn.second.data() - state.buffer)};
+
+        if (tkn.first == State::UNKNOWN)
         {
-          column++;
+          p.resume = st.index;
+          break;
         }
+        else if (offset >= cuts[k + 1])
+        {
+          p.resume = offset;
+          break;
+        }
+        p.kinds.push_back(tkn.first);
+        p.offsets.push_back(offset);
+        p.lengths.push_back(tkn.second.size());
+      }
+    });
+
+    Tape out;
+    State st{state};
+    std::pair<State::Token, std::string_view> tkn{State::EOI, {}};
+    st.skip_whitespace();
+
+    for (size_t k = 0; k < count && st; k++)
+    {
+      const Piece& p{pieces[k]};
+      while (st)
+      {
+        size_t j{static_cast<size_t>(std::lower_bound(p.offsets.begin(), p.offsets.end(), st.index) - p.offsets.begin())};
+
+        if (j < p.offsets.size() && p.offsets[j] == st.index)
+        {
+          append(out, p, j);
+          st.index = p.resume;
+          break;
+        }
+        else if (j == p.offsets.size())
+        {
+          break;
+        }
+        else if ((tkn = st.token()).first == State::UNKNOWN)
+        {
+          break;
+        }
+
+        out.kinds.push_back(tkn.first);
+        out.offsets.push_back(tkn.second.data() - st.buffer);
+        out.lengths.push_back(tkn.second.size());
       }
     }
+
+    while (tkn.first != State::UNKNOWN && (tkn = st.token()).first != State::EOI && tkn.first != State::UNKNOWN)
+    {
+      out.kinds.push_back(tkn.first);
+      out.offsets.push_back(tkn.second.data() - st.buffer);
+      out.lengths.push_back(tkn.second.size());
+    }
+
+    out.state = state;
+    out.end = st.index;
+    return out;
+  }
+
+  size_t Tape::size() const
+  {
+    return kinds.size();
   }
 
-  std::string State::location()
+  std::string_view Tape::text(size_t i) const
   {
-    const size_t len{512};
-    char buf[len];
-    int end = snprintf(buf, len, "%s:%zu:%zu", filename.c_str(), lineno + 1, column + 1);
-    return std::string(buf, end);
+    return std::string_view(state.buffer + offsets[i], lengths[i]);
   }
 
-  std::string State::token_to_string(Token t)
+  std::pair<State::Token, std::string_view> Tape::operator[](size_t i) const
   {
-    std::stringstream ss;
+    return {kinds[i], text(i)};
+  }
+
+  State Tape::at(size_t offset) const
+  {
+    State out{state};
+    out.index = offset;
+    return out;
+  }
+
+  void State::skip_whitespace()
+  {
+    size_t stop{std::min(len, index + long_run)};
+    for (; index < stop && (buffer[index] == ' ' || buffer[index] == '\t' ||
+                            buffer[index] == '\n' || buffer[index] == '\r'); index++)
+    {}
+
+    if (index == stop && index < len)
+    {
+      index = Scan::whitespace(buffer, index, len);
+    }
+  }
+
+
+  void State::bump(size_t len_)
+  {
+    index += std::min(len_, remaining_len());
+  }
+
+  size_t State::lineno() const
+  {
+    return source ? source->position(index).first : 0;
+  }
+
+  size_t State::column() const
+  {
+    return source ? source->position(index).second : index;
+  }
+
+  std::string State::location() const
+  {
+    return filename() + ":" + std::to_string(lineno() + 1) + ":" + std::to_string(column() + 1);
+  }
+
+  const char *State::token_to_string(Token t)
+  {
+    const char *out{"UNKNOWN"};
     switch (t)
     {
     case IDENT:
-      ss << "IDENT";
+      out = "IDENT";
       break;
     case BIN:
-      ss << "BIN";
+      out = "BIN";
       break;
     case OCT:
-      ss << "OCT";
+      out = "OCT";
       break;
     case DEC:
-      ss << "DEC";
+      out = "DEC";
       break;
     case HEX:
-      ss << "HEX";
+      out = "HEX";
       break;
     case FLT:
-      ss << "FLT";
+      out = "FLT";
       break;
     case RATIONAL:
-      ss << "RATIONAL";
+      out = "RATIONAL";
       break;
     case CHAR:
-      ss << "CHAR";
+      out = "CHAR";
       break;
     case BOOL:
-      ss << "BOOL";
+      out = "BOOL";
       break;
     case STRING:
-      ss << "STRING";
+      out = "STRING";
       break;
     case SYMBOL:
-      ss << "SYMBOL";
+      out = "SYMBOL";
       break;
     case CONS_START:
-      ss << "CONS_START";
+      out = "CONS_START";
       break;
     case LIST_START:
-      ss << "LIST_START";
+      out = "LIST_START";
       break;
     case LIST_END:
-      ss << "LIST_END";
+      out = "LIST_END";
       break;
     case COMMENT:
-      ss << "COMMENT";
+      out = "COMMENT";
       break;
     case EOI:
-      ss << "EOI";
+      out = "EOI";
       break;
     case UNKNOWN:
-      ss << "UNKNOWN";
+      out = "UNKNOWN";
       break;
     }
-    return ss.str();
+    return out;
   }
 
-  std::pair<State, Ident> Ident::parse(const State& state)
-  {
-    bool ok = (bool)state;
-    State st{state};
-    std::pair<State::Token, std::string> tkn;
-    std::pair<State, Ident> out;
+  namespace {
+    using Lexeme = std::pair<State::Token, std::string_view>;
 
-    if (!ok)
+    template <typename T>
+    std::pair<State, T> unwrap(Result<T>&& r)
     {
-      state.fail("End of input");
+      if (r.error)
+      {
+        r.state.fail(r.error);
+      }
+      return {std::move(r.state), std::move(r.value)};
     }
 
-    if (ok)
+    // Lexes a single token and converts it with `read`. The state only
+    // advances if the conversion succeeds. Readers that `allocate` need
+    // State::arena; numbers, bools, chars and names parse without one.
+    template <typename T>
+    Result<T> read_one(const State& state, const char *(*read)(const Lexeme&, T&, Arena&), bool allocates)
     {
-      tkn = st.token();
-      ok = tkn.first == State::IDENT;
-    }
+      Result<T> out{state, {}, nullptr};
+      State st{state};
+
+      if (!st)
+      {
+        out.error = "End of input";
+      }
+      else if (allocates && !st.arena)
+      {
+        out.error = "No arena to parse into";
+      }
+      else
+      {
+        // Only ever handed to readers that do not allocate.
+        Arena none;
+        out.error = read(st.token(), out.value, st.arena ? *st.arena : none);
+      }
+
+      if (!out.error)
+      {
+        out.state = std::move(st);
+      }
 
-    if (ok)
-    {
-      out.second.val = tkn.second;
-      out.first = st;
+      return out;
     }
 
-    if (!ok)
+    const char *read_ident(const Lexeme& tkn, Ident& out, Arena&)
     {
-      state.fail("Expected ident token");
+      const char *err{nullptr};
+
+      if (tkn.first == State::IDENT)
+      {
+        std::tie(out.id, out.val) = Names::intern(tkn.second);
+      }
+      else
+      {
+        err = "Expected ident token";
+      }
+
+      return err;
     }
-    return out;
+  }
+
+  Result<Ident> Ident::try_parse(const State& state)
+  {
+    return read_one(state, read_ident, false);
+  }
+
+  std::pair<State, Ident> Ident::parse(const State& state)
+  {
+    return unwrap(try_parse(state));
   }
 
   std::ostream& operator<<(std::ostream& os, const Ident& item)
@@ -365,125 +1085,98 @@ namespace lang::parser {
     return os;
   }
 
-  std::pair<State, Number> Number::parse(const State& state)
-  {
-    bool ok = (bool)state;
-    State st{state};
-    std::pair<State::Token, std::string> tkn;
-    std::pair<State, Number> out;
-
-    if (!ok)
+  namespace {
+    // Converts an optional '-', the two-character prefix of a base other
+    // than 10 and the digits, straight from the source text. The magnitude
+    // is read unsigned so INT64_MIN still fits.
+    const char *read_integer(const char *first, const char *last, int base, int64_t& out)
     {
-      state.fail("End of input");
-    }
+      const char *err{nullptr};
+      bool neg{first < last && *first == '-'};
+      first += neg + (base != 10 ? 2 : 0);
+
+      uint64_t mag{0};
+      auto [end, ec]{std::from_chars(first, last, mag, base)};
+      if (ec == std::errc::result_out_of_range ||
+          (ec == std::errc() && mag > static_cast<uint64_t>(INT64_MAX) + neg))
+      {
+        err = "Integer literal too large";
+      }
+      else if (ec != std::errc() || end != last)
+      {
+        err = "Invalid integer literal";
+      }
+      else
+      {
+        out = static_cast<int64_t>(neg ? 0 - mag : mag);
+      }
 
-    if (ok)
-    {
-      tkn = st.token();
-      ok = tkn.first == State::BIN || tkn.first == State::OCT ||
-        tkn.first == State::DEC || tkn.first == State::HEX ||
-        tkn.first == State::FLT || tkn.first == State::RATIONAL;
+      return err;
     }
 
-    if (ok)
+    const char *read_number(const Lexeme& tkn, Number& out, Arena&)
     {
-      out.first = st;
-      size_t erase_idx{(tkn.second[0] == '-') ? static_cast<size_t>(1) : static_cast<size_t>(0)};
-      int base(0);
+      const char *err{nullptr};
+      const char *first{tkn.second.data()};
+      const char *last{first + tkn.second.size()};
 
       switch (tkn.first)
       {
       case State::BIN:
-        base = 2;
+        out.kind = Number::N;
+        err = read_integer(first, last, 2, out.i);
         break;
       case State::OCT:
-        base = 8;
-        break;
-      case State::HEX:
-        base = 16;
+        out.kind = Number::N;
+        err = read_integer(first, last, 8, out.i);
         break;
-      default:
-        base = 10;
-      }
-
-      switch (tkn.first)
-      {
-      case State::BIN:
-        [[fallthrough]];
-      case State::OCT:
-        [[fallthrough]];
       case State::DEC:
-        [[fallthrough]];
+        out.kind = Number::N;
+        err = read_integer(first, last, 10, out.i);
+        break;
       case State::HEX:
-      {
-        tkn.second.erase(erase_idx, 2);
-        char *end{reinterpret_cast<char*>(1)};
-        out.second.kind = N;
-        out.second.i = std::strtoll(tkn.second.c_str(), &end, base);
-        if (errno == ERANGE)
-        {
-          state.fail("Integer literal too large");
-        }
-        else if (end != &tkn.second.c_str()[tkn.second.size()])
-        {
-          state.fail("Invalid integer literal");
-        }
-      } break;
+        out.kind = Number::N;
+        err = read_integer(first, last, 16, out.i);
+        break;
       case State::FLT:
       {
-        tkn.second.erase(erase_idx, 2);
-        char *end{reinterpret_cast<char*>(1)};
-        out.second.kind = F;
-        out.second.i = std::strtod(tkn.second.c_str(), &end);
-        if (errno == ERANGE)
+        out.kind = Number::F;
+        auto [end, ec]{std::from_chars(first, last, out.d)};
+        if (ec == std::errc::result_out_of_range)
         {
-          state.fail("Floating-point number literal too large");
+          err = "Floating-point number literal out of range";
         }
-        else if (end != &tkn.second.c_str()[tkn.second.size()])
+        else if (ec != std::errc() || end != last)
         {
-          state.fail("Invalid floating-point number literal");
+          err = "Invalid floating-point number literal";
         }
       } break;
       case State::RATIONAL:
       {
-        out.second.kind = R;
-
-        size_t slash_idx{tkn.second.find('/')};
-        std::string numerator{tkn.second.substr(0, slash_idx)};
-        slash_idx++;
-        std::string denomenator{tkn.second.substr(slash_idx, tkn.second.size() - slash_idx)};
-
-        char *end{reinterpret_cast<char*>(1)};
-        out.second.r.first = std::strtoll(numerator.c_str(), &end, base);
-        if (errno == ERANGE)
-        {
-          state.fail("Integer literal too large");
-        }
-        else if (end != &tkn.second.c_str()[tkn.second.size()])
-        {
-          state.fail("Invalid integer literal");
-        }
-        out.second.r.second = std::strtoll(denomenator.c_str(), &end, base);
-        if (errno == ERANGE)
-        {
-          state.fail("Integer literal too large");
-        }
-        else if (end != &tkn.second.c_str()[tkn.second.size()])
+        out.kind = Number::R;
+        const char *slash{std::find(first, last, '/')};
+        err = read_integer(first, slash, 10, out.r.first);
+        if (!err)
         {
-          state.fail("Invalid integer literal");
+          err = slash == last ? "Invalid integer literal" : read_integer(slash + 1, last, 10, out.r.second);
         }
       } break;
       default:
-        state.fail("Bad token type");
+        err = "Expected number token";
       }
-    }
 
-    if (!ok)
-    {
-      state.fail("Expected number token");
+      return err;
     }
+  }
 
-    return out;
+  Result<Number> Number::try_parse(const State& state)
+  {
+    return read_one(state, read_number, false);
+  }
+
+  std::pair<State, Number> Number::parse(const State& state)
+  {
+    return unwrap(try_parse(state));
   }
 
   std::ostream& operator<<(std::ostream& os, const Number& item)
@@ -505,89 +1198,85 @@ namespace lang::parser {
     return os;
   }
 
-  std::pair<State, Char> Char::parse(const State& state)
-  {
-    bool ok = (bool)state;
-    State st{state};
-    std::pair<State::Token, std::string> tkn;
-    std::pair<State, Char> out;
-
-    if (!ok)
-    {
-      state.fail("End of input");
-    }
-
-    if (ok)
+  namespace {
+    const char *read_char(const Lexeme& tkn, Char& out, Arena&)
     {
-      tkn = st.token();
-      ok = tkn.first == State::CHAR;
-    }
-
-    if (ok)
-    {
-      out.first = st;
-      std::string chr{tkn.second.substr(1, tkn.second.size() - 2)};
+      const char *err{nullptr};
 
-      if (chr[0] == '\\' && chr.size() > 1)
+      if (tkn.first == State::CHAR)
       {
-        switch (chr[1])
+        std::string_view chr{tkn.second.substr(1, tkn.second.size() - 2)};
+
+        if (chr[0] == '\\' && chr.size() > 1)
         {
-          case 'a': {
-            out.second.val = '\a';
-          } break;
-          case 'b': {
-            out.second.val = '\b';
-          } break;
-          case 'f': {
-            out.second.val = '\f';
-          } break;
-          case 'n': {
-            out.second.val = '\n';
-          } break;
-          case 't': {
-            out.second.val = '\t';
-          } break;
-          case 'v': {
-            out.second.val = '\v';
-          } break;
-          case 'r': {
-            out.second.val = '\r';
-          } break;
-          case '\'': {
-            out.second.val = '\'';
-          } break;
-          case '"': {
-            out.second.val = '"';
-          } break;
-          case 'x': {
-            if (chr.size() == 4)
-            {
-              char c1 = chr[2];
-              char c2 = chr[3];
-              out.second.val = ((c1 & 0xF) << 4) | (c2 & 0xF);
-            }
-            else
-            {
-              state.fail("\\x escape sequences must have two hex chars");
+          switch (chr[1])
+          {
+            case 'a': {
+              out.val = '\a';
+            } break;
+            case 'b': {
+              out.val = '\b';
+            } break;
+            case 'f': {
+              out.val = '\f';
+            } break;
+            case 'n': {
+              out.val = '\n';
+            } break;
+            case 't': {
+              out.val = '\t';
+            } break;
+            case 'v': {
+              out.val = '\v';
+            } break;
+            case 'r': {
+              out.val = '\r';
+            } break;
+            case '\'': {
+              out.val = '\'';
+            } break;
+            case '"': {
+              out.val = '"';
+            } break;
+            case 'x': {
+              if (chr.size() == 4)
+              {
+                char c1 = chr[2];
+                char c2 = chr[3];
+                out.val = ((c1 & 0xF) << 4) | (c2 & 0xF);
+              }
+              else
+              {
+                err = "\\x escape sequences must have two hex chars";
+              }
+            } break;
+            default: {
+              err = "Invalid escape sequence";
             }
-          } break;
-          default: {
-            state.fail("Invalid escape sequence");
           }
         }
+        else
+        {
+          out.val = chr[0];
+        }
       }
       else
       {
-        out.second.val = chr[0];
+        err = "Expected char token";
       }
-    }
 
-    if (!ok)
-    {
-      state.fail("Expected char token");
+      return err;
     }
+  }
 
-    return out;
+  Result<Char> Char::try_parse(const State& state)
+  {
+    return read_one(state, read_char, false);
+  }
+
+  std::pair<State, Char> Char::parse(const State& state)
+  {
+    return unwrap(try_parse(state));
   }
 
   std::ostream& operator<<(std::ostream& os, const Char& item)
@@ -596,31 +1285,32 @@ namespace lang::parser {
     return os;
   }
 
-  std::pair<State, Bool> Bool::parse(const State& state)
-  {
-    bool ok = (bool)state;
-    State st{state};
-    std::pair<State::Token, std::string> tkn;
-    std::pair<State, Bool> out;
-
-    if (ok)
+  namespace {
+    const char *read_bool(const Lexeme& tkn, Bool& out, Arena&)
     {
-      tkn = st.token();
-      ok = tkn.first == State::BOOL;
-    }
+      const char *err{nullptr};
 
-    if (ok)
-    {
-      out.first = st;
-      out.second.val = tkn.second.compare("true") == 0;
-    }
+      if (tkn.first == State::BOOL)
+      {
+        out.val = tkn.second.compare("true") == 0;
+      }
+      else
+      {
+        err = "Expected bool token";
+      }
 
-    if (!ok)
-    {
-      state.fail("Expected bool token");
+      return err;
     }
+  }
 
-    return out;
+  Result<Bool> Bool::try_parse(const State& state)
+  {
+    return read_one(state, read_bool, false);
+  }
+
+  std::pair<State, Bool> Bool::parse(const State& state)
+  {
+    return unwrap(try_parse(state));
   }
 
   std::ostream& operator<<(std::ostream& os, const Bool& item)
@@ -629,31 +1319,32 @@ namespace lang::parser {
     return os;
   }
 
-  std::pair<State, String> String::parse(const State& state)
-  {
-    bool ok = (bool)state;
-    State st{state};
-    std::pair<State::Token, std::string> tkn;
-    std::pair<State, String> out;
-
-    if (ok)
+  namespace {
+    const char *read_string(const Lexeme& tkn, String& out, Arena& arena)
     {
-      tkn = st.token();
-      ok = tkn.first == State::STRING;
-    }
+      const char *err{nullptr};
 
-    if (ok)
-    {
-      out.first = st;
-      out.second.val = tkn.second.substr(1, tkn.second.size() - 2);
-    }
+      if (tkn.first == State::STRING)
+      {
+        out.val = arena.copy(tkn.second.substr(1, tkn.second.size() - 2));
+      }
+      else
+      {
+        err = "Expected string token";
+      }
 
-    if (!ok)
-    {
-      state.fail("Expected string token");
+      return err;
     }
+  }
 
-    return out;
+  Result<String> String::try_parse(const State& state)
+  {
+    return read_one(state, read_string, true);
+  }
+
+  std::pair<State, String> String::parse(const State& state)
+  {
+    return unwrap(try_parse(state));
   }
 
   std::ostream& operator<<(std::ostream& os, const String& item)
@@ -662,31 +1353,32 @@ namespace lang::parser {
     return os;
   }
 
-  std::pair<State, Symbol> Symbol::parse(const State& state)
-  {
-    bool ok = (bool)state;
-    State st{state};
-    std::pair<State::Token, std::string> tkn;
-    std::pair<State, Symbol> out;
-
-    if (ok)
+  namespace {
+    const char *read_symbol(const Lexeme& tkn, Symbol& out, Arena&)
     {
-      tkn = st.token();
-      ok = tkn.first == State::SYMBOL;
-    }
+      const char *err{nullptr};
 
-    if (ok)
-    {
-      out.first = st;
-      out.second.val = tkn.second.substr(1, tkn.second.size() - 1);
-    }
+      if (tkn.first == State::SYMBOL)
+      {
+        std::tie(out.id, out.val) = Names::intern(tkn.second.substr(1));
+      }
+      else
+      {
+        err = "Expected symbol token";
+      }
 
-    if (!ok)
-    {
-      state.fail("Expected string token");
+      return err;
     }
+  }
 
-    return out;
+  Result<Symbol> Symbol::try_parse(const State& state)
+  {
+    return read_one(state, read_symbol, false);
+  }
+
+  std::pair<State, Symbol> Symbol::parse(const State& state)
+  {
+    return unwrap(try_parse(state));
   }
 
   std::ostream& operator<<(std::ostream& os, const Symbol& item)
@@ -695,107 +1387,68 @@ namespace lang::parser {
     return os;
   }
 
-  std::pair<State, Atom> Atom::parse(const State& state)
-  {
-    bool ok = (bool)state;
-    State st{state};
-    std::pair<State::Token, std::string> tkn;
-    std::pair<State, Atom> out;
-
-    if (ok)
+  namespace {
+    bool is_atom(State::Token t)
     {
-      ok = false;
-      try
-      {
-        std::pair<State, Number> n{Number::parse(st)};
-        ok = true;
-        out.second.kind = NU;
-        out.second.n = n.second;
-        out.first = n.first;
-      }
-      catch (std::runtime_error&)
-      {}
-
-      if (!ok)
-      {
-        try
-        {
-          std::pair<State, Bool> i{Bool::parse(state)};
-          ok = true;
-          out.second.kind = BL;
-          out.second.b = i.second;
-          out.first = i.first;
-        }
-        catch (std::runtime_error&)
-        {}
-      }
-
-      if (!ok)
-      {
-        try
-        {
-          std::pair<State, Ident> i{Ident::parse(state)};
-          ok = true;
-          out.second.kind = ID;
-          out.second.i = new Ident;
-          out.first = i.first;
-          *out.second.i = i.second;
-        }
-        catch (std::runtime_error&)
-        {}
-      }
-
-      if (!ok)
-      {
-        try
-        {
-          std::pair<State, Char> i{Char::parse(state)};
-          ok = true;
-          out.second.kind = CH;
-          out.second.c = i.second;
-          out.first = i.first;
-        }
-        catch (std::runtime_error&)
-        {}
-      }
+      return t != State::CONS_START && t != State::LIST_START &&
+        t != State::LIST_END && t != State::COMMENT &&
+        t != State::EOI && t != State::UNKNOWN;
+    }
 
-      if (!ok)
-      {
-        try
-        {
-          std::pair<State, String> i{String::parse(state)};
-          ok = true;
-          out.second.kind = ST;
-          out.second.s = new String;
-          *out.second.s = i.second;
-          out.first = i.first;
-        }
-        catch (std::runtime_error&)
-        {}
-      }
+    const char *read_atom(const Lexeme& tkn, Atom& out, Arena& arena)
+    {
+      const char *err{nullptr};
 
-      if (!ok)
+      switch (tkn.first)
       {
-        try
-        {
-          std::pair<State, Symbol> i{Symbol::parse(state)};
-          ok = true;
-          out.second.kind = SY;
-          out.second.sy = new Symbol;
-          *out.second.sy = i.second;
-          out.first = i.first;
-        }
-        catch (std::runtime_error&)
-        {}
+      case State::BIN:
+      case State::OCT:
+      case State::DEC:
+      case State::HEX:
+      case State::FLT:
+      case State::RATIONAL:
+        out.kind = Atom::NU;
+        err = read_number(tkn, out.n, arena);
+        break;
+      case State::BOOL:
+        out.kind = Atom::BL;
+        err = read_bool(tkn, out.b, arena);
+        break;
+      case State::IDENT:
+        out.kind = Atom::ID;
+        out.i = arena.make<Ident>();
+        err = read_ident(tkn, *out.i, arena);
+        break;
+      case State::CHAR:
+        out.kind = Atom::CH;
+        err = read_char(tkn, out.c, arena);
+        break;
+      case State::STRING:
+        out.kind = Atom::ST;
+        out.s = arena.make<String>();
+        err = read_string(tkn, *out.s, arena);
+        break;
+      case State::SYMBOL:
+        out.kind = Atom::SY;
+        out.sy = arena.make<Symbol>();
+        err = read_symbol(tkn, *out.sy, arena);
+        break;
+      default:
+        err = "Expected ident, number, bool, char, string, or symbol token";
       }
 
-      if (!ok)
-      {
-        state.fail("Expected ident, number, bool, char, string, or symbol token");
-      }
+      return err;
     }
+  }
 
-    return out;
+  Result<Atom> Atom::try_parse(const State& state)
+  {
+    return read_one(state, read_atom, true);
+  }
+
+  std::pair<State, Atom> Atom::parse(const State& state)
+  {
+    return unwrap(try_parse(state));
   }
 
   std::ostream& operator<<(std::ostream& os, const Atom& item)
@@ -852,114 +1505,269 @@ namespace lang::parser {
     , kind(SY)
   {}
 
-  Atom::Atom(const Atom& a)
-  {
-    *this = a;
-  }
+  namespace {
+    // Items of the lists currently being read, innermost last. Each list
+    // copies its own run into the arena once it is closed.
+    thread_local std::vector<Value> pending;
+
+    // Lists opened but not yet closed, innermost last, with where their
+    // items start in `pending`. Together the two stacks take memory in
+    // proportion to the nesting depth, not the native stack.
+    struct Open
+    {
+      List *list;
+      size_t first;
+    };
+    thread_local std::vector<Open> open;
+
+    // Tokens straight from a State. On failure the State is put back at
+    // the start of the token the error is about. `count` is how many were
+    // read, not counting the end of input or a token put back.
+    struct StateTokens
+    {
+      Lexeme next()
+      {
+        start = st;
+        Lexeme tkn{st.token()};
+        counted = tkn.first != State::EOI;
+        count += counted;
+        return tkn;
+      }
+
+      void rewind()
+      {
+        st = start;
+        count -= counted;
+        counted = false;
+      }
+
+      // Where the last token starts.
+      const State& here() const
+      {
+        return start;
+      }
+
+      // Steps over the bytes no token starts with, up to the next space or
+      // paren, and returns how many there were.
+      size_t skip_unknown()
+      {
+        size_t from{st.index};
+        do
+        {
+          st.bump();
+        }
+        while (st && !strchr(" \t\r\n()", st.buffer[st.index]));
+        size_t length{st.index - from};
+        st.skip_whitespace();
+        return length;
+      }
+
+      State& st;
+      State start;
+      size_t count{0};
+      bool counted{false};
+    };
+
+    // Tokens from a Tape. Past the last one it yields EOI, or UNKNOWN if
+    // lexing stopped early, and leaves `i` at the tape's size.
+    struct TapeTokens
+    {
+      Lexeme next()
+      {
+        taken = i < tape.size();
+        return taken ? tape[i++] :
+          Lexeme{tape.end == tape.state.len ? State::EOI : State::UNKNOWN, {}};
+      }
+
+      void rewind()
+      {
+        i -= taken;
+      }
+
+      State here() const
+      {
+        return tape.at(taken ? tape.offsets[i - 1] : tape.end);
+      }
+
+      // Nothing past an unknown byte was lexed, so there is nothing to
+      // step to; recovering is only offered when parsing from a State.
+      size_t skip_unknown()
+      {
+        return 0;
+      }
+
+      const Tape& tape;
+      size_t& i;
+      bool taken;
+    };
+
+    // Reads one value, however deeply nested, without recursing. Every
+    // error is reported at the token it is about, as rewind() leaves it.
+    //
+    // Given `diagnostics`, errors inside the value are recorded there
+    // instead: the offending token or nested list is dropped, and lists
+    // still open at the end of input are closed. The only error returned
+    // is then running out of input before any value.
+    template <typename Tokens>
+    const char *read_tree(Tokens& in, Arena& arena, size_t max_depth, Value& out,
+                          std::vector<Diagnostic> *diagnostics = nullptr)
+    {
+      const char *err{nullptr};
+      const size_t base_open{open.size()};
+      const size_t base_pending{pending.size()};
+      bool done{false};
+
+      auto close = [&]() {
+        Open& o{open.back()};
+        o.list->val = arena.array(pending.data() + o.first, pending.size() - o.first);
+        pending.resize(o.first);
+        open.pop_back();
+        done = open.size() == base_open;
+      };
+
+      while (!err && !done)
+      {
+        Lexeme tkn{in.next()};
+        Value v{};
+
+        if (tkn.first == State::LIST_START || tkn.first == State::CONS_START)
+        {
+          if (open.size() - base_open >= max_depth)
+          {
+            err = "List nested deeper than the limit";
+          }
+          else
+          {
+            v.kind = Value::L;
+            v.l = arena.make<List>();
+            v.l->is_cons = tkn.first == State::CONS_START;
+          }
+        }
+        else if (is_atom(tkn.first))
+        {
+          v.kind = Value::A;
+          v.a = arena.make<Atom>();
+          err = read_atom(tkn, *v.a, arena);
+        }
+        else if (tkn.first == State::LIST_END && open.size() > base_open)
+        {
+          close();
+          continue;
+        }
+        else if (tkn.first == State::EOI && open.size() > base_open)
+        {
+          err = "Expected list end token";
+        }
+        else
+        {
+          err = "Expected list or atom";
+        }
+
+        if (err && diagnostics && (tkn.first != State::EOI || open.size() > base_open))
+        {
+          const State& at{in.here()};
+          size_t length{tkn.first == State::UNKNOWN ? in.skip_unknown() : tkn.second.size()};
+          size_t base{at.source ? at.source->origin.offset : 0};
+          diagnostics->push_back({base + at.index, base + at.index + length, at.describe(err)});
+          err = nullptr;
 
-  Atom::~Atom()
-  {
-    if (kind == ST && s)
-    {
-      delete s;
-      s = 0;
-    }
-    else if (kind == ID && i)
-    {
-      delete i;
-      i = 0;
-    }
-    else if (kind == SY && sy)
-    {
-      delete sy;
-      sy = 0;
-    }
-  }
+          if (tkn.first == State::EOI)
+          {
+            while (!done)
+            {
+              close();
+            }
+          }
+          else if (tkn.first == State::LIST_START || tkn.first == State::CONS_START)
+          {
+            for (size_t depth = 1; depth > 0;)
+            {
+              Lexeme t{in.next()};
+              depth += t.first == State::LIST_START || t.first == State::CONS_START;
+              depth -= t.first == State::LIST_END;
+              depth = t.first == State::EOI ? 0 : depth;
+              if (t.first == State::UNKNOWN)
+              {
+                in.skip_unknown();
+              }
+            }
+          }
+          continue;
+        }
 
-  Atom& Atom::operator=(const Atom& a)
-  {
-    kind = a.kind;
-    switch (kind)
-    {
-      case NU:
-        n = a.n;
-      break;
-      case CH:
-        c = a.c;
-      break;
-      case BL:
-        b = a.b;
-      break;
-      case ST:
-        if (a.s)
+        if (err)
         {
-          s = new String;
-          *s = *a.s;
+          in.rewind();
         }
-      break;
-      case ID:
-        if (a.i)
+        else if (open.size() == base_open)
         {
-          i = new Ident;
-          *i = *a.i;
+          out = v;
+          done = v.kind == Value::A;
         }
-      break;
-      case SY:
-        if (a.sy)
+        else
         {
-          sy = new Symbol;
-          *sy = *a.sy;
+          pending.push_back(v);
         }
-      break;
+
+        if (!err && v.kind == Value::L)
+        {
+          open.push_back({v.l, pending.size()});
+        }
+      }
+
+      open.resize(base_open);
+      pending.resize(base_pending);
+
+      // The stacks live as long as the thread, so a deep or wide input
+      // would leave its peak capacity behind; past a few pages it is given
+      // back once the outermost read is done.
+      const size_t keep{4096};
+      if (open.empty() && open.capacity() > keep)
+      {
+        open.shrink_to_fit();
+      }
+      if (pending.empty() && pending.capacity() > keep)
+      {
+        pending.shrink_to_fit();
+      }
+      return err;
     }
-    return *this;
   }
 
-  std::pair<State, List> List::parse(const State& state)
+  Result<List> List::try_parse(const State& state)
   {
-    bool ok = (bool)state;
+    Result<List> out{state, {}, nullptr};
     State st{state};
-    std::pair<State::Token, std::string> tkn;
-    std::pair<State, List> out;
+    Lexeme tkn{State(state).token()};
 
-    if (ok)
+    if (!st.arena)
     {
-      tkn = st.token();
-      ok = tkn.first == State::LIST_START || tkn.first == State::CONS_START;
+      out.error = "No arena to parse into";
     }
-
-    if (ok)
+    else if (tkn.first == State::LIST_START || tkn.first == State::CONS_START)
     {
-      while (st)
+      StateTokens in{st, st};
+      Value v{};
+      out.error = read_tree(in, *st.arena, st.max_depth, v);
+      if (!out.error)
       {
-        try
-        {
-          auto p{Value::parse(st)};
-          out.second.val.push_back(p.second);
-          st = std::move(p.first);
-        }
-        catch (std::runtime_error&)
-        {
-          break;
-        }
+        out.value = *v.l;
       }
-
-      tkn = st.token();
-      ok = tkn.first == State::LIST_END;
-    }
-
-    if (ok)
-    {
-      out.first = std::move(st);
+      out.state = std::move(st);
     }
     else
     {
-      state.fail("Expected list or cons start token");
+      out.error = "Expected list or cons start token";
     }
 
     return out;
   }
 
+  std::pair<State, List> List::parse(const State& state)
+  {
+    return unwrap(try_parse(state));
+  }
+
   std::ostream& operator<<(std::ostream& os, const List& item)
   {
     os << "L( ";
@@ -971,52 +1779,34 @@ namespace lang::parser {
     return os;
   }
 
-  std::pair<State, Value> Value::parse(const State& state)
+  Result<Value> Value::try_parse(const State& state)
   {
-    bool ok = (bool)state;
+    Result<Value> out{state, {}, nullptr};
     State st{state};
-    std::pair<State::Token, std::string> tkn;
-    std::pair<State, Value> out;
 
-    if (ok)
+    if (!st)
     {
-      ok = false;
-      try
-      {
-        std::pair<State, List> n{List::parse(st)};
-        ok = true;
-        out.second.kind = L;
-        out.second.l = new List;
-        out.second.l->val = n.second.val;
-        out.first = n.first;
-      }
-      catch (std::runtime_error&)
-      {}
-
-      if (!ok)
-      {
-        try
-        {
-          std::pair<State, Atom> i{Atom::parse(state)};
-          ok = true;
-          out.second.kind = A;
-          out.second.a = new Atom;
-          *out.second.a = i.second;
-          out.first = i.first;
-        }
-        catch (std::runtime_error&)
-        {}
-      }
-
-      if (!ok)
-      {
-        state.fail("Expected list or atom");
-      }
+      out.error = "End of input";
+    }
+    else if (!st.arena)
+    {
+      out.error = "No arena to parse into";
+    }
+    else
+    {
+      StateTokens in{st, st};
+      out.error = read_tree(in, *st.arena, st.max_depth, out.value);
+      out.state = std::move(st);
     }
 
     return out;
   }
 
+  std::pair<State, Value> Value::parse(const State& state)
+  {
+    return unwrap(try_parse(state));
+  }
+
   std::ostream& operator<<(std::ostream& os, const Value& item)
   {
     os << "V(";
@@ -1065,25 +1855,417 @@ namespace lang::parser {
       std::cout << "File::parse at " << state.location() << std::endl;
     }
     exprs.clear();
+    spans.clear();
+    arena.release();
 
-    while (state)
+    State st{state};
+    st.arena = &arena;
+    st.skip_whitespace();
+
+    while (st)
     {
-      auto p{Value::parse(state)};
+      size_t start{st.index};
+      auto p{unwrap(Value::try_parse(st))};
       exprs.push_back(p.second);
-      state = std::move(p.first);
+      st = std::move(p.first);
+      spans.emplace_back(start, st.index);
+    }
+
+    parsed = arena.bytes;
+    st.arena = state.arena;
+    state = std::move(st);
+  }
+
+  void File::parse(State& state, std::vector<Diagnostic>& diagnostics)
+  {
+    exprs.clear();
+    spans.clear();
+    arena.release();
+
+    State st{state};
+    st.skip_whitespace();
+
+    while (st)
+    {
+      size_t start{st.index};
+      StateTokens in{st, st};
+      Value v{};
+      if (!read_tree(in, arena, st.max_depth, v, &diagnostics))
+      {
+        exprs.push_back(v);
+        spans.emplace_back(start, st.index);
+      }
+    }
+
+    parsed = arena.bytes;
+    state = std::move(st);
+  }
+
+  void File::parse(const Tape& tape)
+  {
+    exprs.clear();
+    spans.clear();
+    arena.release();
+
+    size_t i{0};
+    TapeTokens in{tape, i, false};
+    while (i < tape.size())
+    {
+      Value v{};
+      size_t start{tape.offsets[i]};
+      const char *err{read_tree(in, arena, tape.state.max_depth, v)};
+      if (err)
+      {
+        tape.at(i < tape.size() ? tape.offsets[i] : tape.end).fail(err);
+      }
+      exprs.push_back(v);
+      spans.emplace_back(start, i < tape.size() ? tape.offsets[i] : tape.end);
+    }
+
+    if (tape.end < tape.state.len)
+    {
+      tape.at(tape.end).fail("Expected list or atom");
+    }
+    parsed = arena.bytes;
+  }
+
+  namespace {
+    // Offsets just past the `)` closing a top-level form, spaced at least
+    // `chunk` bytes apart. Only parens, strings and chars matter for depth;
+    // char and escape rules follow the lexer, so '(' is a cons start and
+    // ')' a char. Empty if the depth ever goes wrong, in which case the
+    // input is left to the serial parser to report.
+    std::vector<size_t> split_forms(const char *buffer, size_t from, size_t len, size_t chunk)
+    {
+      std::vector<size_t> out;
+      size_t depth{0}, last{from};
+      bool ok{true};
+
+      for (size_t i = from; ok && i < len; i++)
+      {
+        switch (buffer[i])
+        {
+        case '(':
+          depth++;
+          break;
+        case ')':
+          ok = depth > 0;
+          depth -= ok;
+          if (ok && depth == 0 && i + 1 - last >= chunk)
+          {
+            last = i + 1;
+            out.push_back(last);
+          }
+          break;
+        case '"':
+          for (i++; (i = Scan::string_body(buffer, i, len)) < len && buffer[i] == '\\'; i += 2)
+          {}
+          ok = i < len && buffer[i] == '"';
+          break;
+        case '\'':
+          if (i + 1 < len && buffer[i + 1] == '(')
+          {
+            depth++;
+            i++;
+          }
+          else if (i + 2 < len && buffer[i + 1] == '\\')
+          {
+            i += buffer[i + 2] == 'x' ? 4 : 2;
+            i += i + 1 < len && buffer[i + 1] == '\'';
+          }
+          else if (i + 2 < len && buffer[i + 2] == '\'')
+          {
+            i += 2;
+          }
+          break;
+        case '\0':
+          ok = false;
+          break;
+        }
+      }
+
+      if (!ok || depth > 0)
+      {
+        out.clear();
+      }
+      else if (!out.empty())
+      {
+        out.back() = len;
+      }
+      return out;
+    }
+  }
+
+  void File::parse(State& state, Pool& pool, size_t chunk)
+  {
+    std::vector<size_t> ends{split_forms(state.buffer, state.index, state.len, std::max<size_t>(chunk, 1))};
+
+    if (ends.size() < 2 || pool.size() < 2)
+    {
+      parse(state);
+      return;
+    }
+
+    if (!state.quiet)
+    {
+      std::cout << "File::parse at " << state.location() << std::endl;
+    }
+    exprs.clear();
+    spans.clear();
+    arena.release();
+
+    std::vector<Arena> arenas(pool.size());
+    std::vector<std::vector<Value>> parts(ends.size());
+    std::vector<std::vector<size_t>> starts(ends.size());
+    std::atomic<bool> failed{false};
+
+    pool.run(ends.size(), [&](size_t i, size_t worker) {
+      State st{state};
+      st.index = i == 0 ? state.index : ends[i - 1];
+      st.len = ends[i];
+      st.arena = &arenas[worker];
+      st.skip_whitespace();
+
+      while (st && !failed)
+      {
+        Result<Value> r{Value::try_parse(st)};
+        if (r.error)
+        {
+          failed = true;
+        }
+        else
+        {
+          parts[i].push_back(r.value);
+          starts[i].push_back(st.index);
+        }
+        st = std::move(r.state);
+      }
+    });
+
+    if (failed)
+    {
+      // Parse serially so the error is the one the serial parser reports.
+      parse(state);
+      return;
+    }
+
+    size_t count{0};
+    for (auto& p : parts)
+    {
+      count += p.size();
+    }
+    exprs.reserve(count);
+    spans.reserve(count);
+    for (size_t i = 0; i < parts.size(); i++)
+    {
+      exprs.insert(exprs.end(), parts[i].begin(), parts[i].end());
+      for (size_t start : starts[i])
+      {
+        spans.emplace_back(start, 0);
+      }
+    }
+    // A piece stops right after its last `)`, so each form runs to where
+    // the next one starts, as in the serial parse.
+    for (size_t k = 0; k < spans.size(); k++)
+    {
+      spans[k].second = k + 1 < spans.size() ? spans[k + 1].first : state.len;
+    }
+    for (auto& a : arenas)
+    {
+      arena.absorb(std::move(a));
+    }
+
+    parsed = arena.bytes;
+    state.index = state.len;
+  }
+
+  // The forms from the first one whose span reaches the edit are parsed
+  // again from the new text, until the parse lands exactly on the start of
+  // an old form past the edit. From there the text and so the forms are the
+  // same as before, only shifted, so the rest is kept.
+  void File::reparse(const State& state, size_t offset, size_t removed, size_t inserted)
+  {
+    size_t first{static_cast<size_t>(
+      std::lower_bound(spans.begin(), spans.end(), offset,
+                       [](const std::pair<size_t, size_t>& s, size_t o) { return s.second < o; }) -
+      spans.begin())};
+    // A form starting right at the end of the edit may merge with the new
+    // text, so only ones starting after it can be kept.
+    size_t keep{static_cast<size_t>(
+      std::upper_bound(spans.begin() + first, spans.end(), offset + removed,
+                       [](size_t o, const std::pair<size_t, size_t>& s) { return o < s.first; }) -
+      spans.begin())};
+
+    // Parsed straight into the file's arena: a failed parse only leaves
+    // unused bytes there, and small edits then share its current block.
+    std::vector<Value> forms;
+    std::vector<std::pair<size_t, size_t>> fresh_spans;
+    State st{state};
+    st.arena = &arena;
+    st.index = first > 0 ? spans[first - 1].second : state.index;
+    st.skip_whitespace();
+
+    while (st)
+    {
+      // Old offsets plus `inserted` compared against new ones plus
+      // `removed`, so a shrinking edit never goes below zero.
+      while (keep < spans.size() && spans[keep].first + inserted < st.index + removed)
+      {
+        keep++;
+      }
+      if (keep < spans.size() && spans[keep].first + inserted == st.index + removed)
+      {
+        break;
+      }
+
+      size_t start{st.index};
+      auto p{unwrap(Value::try_parse(st))};
+      forms.push_back(p.second);
+      st = std::move(p.first);
+      fresh_spans.emplace_back(start, st.index);
+    }
+
+    if (!st)
+    {
+      keep = spans.size();
     }
+    for (size_t k = keep; k < spans.size(); k++)
+    {
+      spans[k].first = spans[k].first + inserted - removed;
+      spans[k].second = spans[k].second + inserted - removed;
+    }
+
+    // Overwrite the replaced forms in place, so only a change in their
+    // number moves the ones after them.
+    size_t same{std::min(keep - first, forms.size())};
+    std::copy(forms.begin(), forms.begin() + same, exprs.begin() + first);
+    std::copy(fresh_spans.begin(), fresh_spans.begin() + same, spans.begin() + first);
+    exprs.erase(exprs.begin() + first + same, exprs.begin() + keep);
+    spans.erase(spans.begin() + first + same, spans.begin() + keep);
+    exprs.insert(exprs.begin() + first + same, forms.begin() + same, forms.end());
+    spans.insert(spans.begin() + first + same, fresh_spans.begin() + same, fresh_spans.end());
+
+    // Nodes of the replaced forms are not freed, so once the edits have
+    // allocated as much again as the last full parse, parse it all anew.
+    // That keeps the arena within about twice what the tree needs, at an
+    // amortized cost proportional to the edited text.
+    if (arena.bytes > 2 * parsed + arena_block_size)
+    {
+      State all{state};
+      all.quiet = true;
+      parse(all);
+    }
+  }
+
+  Forms::Forms(const State& state, std::vector<Diagnostic> *diagnostics)
+    : state(state)
+    , arena()
+    , diagnostics(diagnostics)
+    , tokens(0)
+  {
+    this->state.skip_whitespace();
+  }
+
+  std::optional<Value> Forms::next()
+  {
+    std::optional<Value> out;
+
+    arena.reset();
+    if (state)
+    {
+      // With diagnostics, an error only means the input ran out. Without,
+      // errors fail as in Value::parse.
+      StateTokens in{state, state};
+      Value v{};
+      const char *err{read_tree(in, arena, state.max_depth, v, diagnostics)};
+      tokens += in.count;
+      if (!err)
+      {
+        out = v;
+      }
+      else if (!diagnostics)
+      {
+        state.fail(err);
+      }
+    }
+
+    return out;
+  }
+
+  void Events::on_list_start(bool, std::string_view)
+  {}
+
+  void Events::on_list_end(std::string_view)
+  {}
+
+  void Events::on_atom(State::Token, std::string_view)
+  {}
+
+  // Follows read_tree token for token, but only counts how deep it is, as
+  // closing a list needs nothing from the one it opened.
+  void Events::parse(State& state)
+  {
+    State st{state};
+    size_t depth{0};
+    Lexeme tkn{State::UNKNOWN, {}};
+
+    st.skip_whitespace();
+
+    while (tkn.first != State::EOI)
+    {
+      State start{st};
+      const char *err{nullptr};
+      tkn = st.token();
+
+      if (tkn.first == State::LIST_START || tkn.first == State::CONS_START)
+      {
+        if (depth >= st.max_depth)
+        {
+          err = "List nested deeper than the limit";
+        }
+        else
+        {
+          depth++;
+          on_list_start(tkn.first == State::CONS_START, tkn.second);
+        }
+      }
+      else if (is_atom(tkn.first))
+      {
+        on_atom(tkn.first, tkn.second);
+      }
+      else if (tkn.first == State::LIST_END && depth > 0)
+      {
+        depth--;
+        on_list_end(tkn.second);
+      }
+      else if (tkn.first == State::EOI && depth > 0)
+      {
+        err = "Expected list end token";
+      }
+      else if (tkn.first != State::EOI)
+      {
+        err = "Expected list or atom";
+      }
+
+      if (err)
+      {
+        start.fail(err);
+      }
+    }
+
+    state = std::move(st);
   }
 
   std::string File::print()
   {
-    std::stringstream ss;
-    ss << *this;
-    return ss.str();
+    Printer p;
+    p.print(*this);
+    return std::string(p.str());
   }
 
   bool Ident::operator==(const Ident& item) const
   {
-    return val.compare(item.val) == 0;
+    return id == item.id;
   }
   bool Number::operator==(const Number& item) const
   {
@@ -1099,7 +2281,7 @@ namespace lang::parser {
         eq = d == item.d;
         break;
       case R:
-        eq = r == r;
+        eq = r == item.r;
         break;
       }
     }
@@ -1169,7 +2351,7 @@ namespace lang::parser {
   }
   bool Symbol::operator==(const Symbol& item) const
   {
-    return val.compare(item.val) == 0;
+    return id == item.id;
   }
   bool Value::operator==(const Value& item) const
   {
@@ -1204,7 +2386,7 @@ namespace lang::parser {
   }
   bool List::operator==(const List& item) const
   {
-    bool eq{val.size() == item.val.size()};
+    bool eq{is_cons == item.is_cons && val.size() == item.val.size()};
 
     if (eq)
     {
@@ -1214,6 +2396,17 @@ namespace lang::parser {
       }
     }
 
+    return eq;
+  }
+  bool File::operator==(const File& item) const
+  {
+    bool eq{exprs.size() == item.exprs.size()};
+
+    for (size_t i = 0; eq && i < exprs.size(); i++)
+    {
+      eq = exprs[i] == item.exprs[i];
+    }
+
     return eq;
   }
 }
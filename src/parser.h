@@ -4,25 +4,76 @@
 #include <memory>
 #include <vector>
 #include <string>
+#include <string_view>
 #include <cstdint>
 #include <optional>
 #include <ostream>
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <thread>
 
 namespace lang::parser {
 
+  struct Arena;
+
+  // Input text shared by every State parsing it. Immutable once built, so
+  // copying a State only copies a cursor and a reference. The text is either
+  // owned as a string or a read-only file mapping, which is unmapped with
+  // the Source; a mapping is not NUL terminated.
+  struct Source
+  {
+    // Where the text starts in a larger input it was cut from, as a
+    // Stream cuts stdin: byte offset, zero-based line and column.
+    struct Origin
+    {
+      size_t offset;
+      size_t line;
+      size_t column;
+    };
+
+    Source(const std::string& filename, std::string&& data, Origin origin = {0, 0, 0});
+    Source(const std::string& filename, const void *map, size_t map_size);
+    Source(const Source&) = delete;
+    ~Source();
+    Source& operator=(const Source&) = delete;
+
+    const char *buffer() const;
+    size_t size() const;
+
+    // Zero-based line and column of a byte offset, counted from the start
+    // of the whole input. The table of line starts is built on first use,
+    // so parsing never pays for it.
+    std::pair<size_t, size_t> position(size_t offset) const;
+
+    const std::string filename;
+    const Origin origin;
+
+  private:
+    const std::string data;
+    const void *map;
+    const size_t map_size;
+    mutable std::once_flag lines_once;
+    mutable std::vector<size_t> line_starts;
+  };
+
   struct State {
     static State from_file(const std::string& file);
-    static State from_string(const std::string& data);
+    static State from_string(const std::string& data, const std::string& filename = "");
 
     State();
-    State(const State&);
-    State(State&&);
-    ~State();
+    explicit State(std::shared_ptr<const Source> source);
+    State(const State&) = default;
+    State(State&&) = default;
 
-    State& operator=(const State&);
-    State& operator=(State&&);
+    State& operator=(const State&) = default;
+    State& operator=(State&&) = default;
 
-    enum Token
+    enum Token : uint8_t
     {
       IDENT,
       BIN,
@@ -43,27 +94,150 @@ namespace lang::parser {
       UNKNOWN
     };
 
-    std::string filename;
+    std::shared_ptr<const Source> source;
+    // Where parsed nodes are allocated. Standalone parses of strings,
+    // atoms, lists and values fail without one; numbers, bools, chars,
+    // idents and symbols do not need it.
+    Arena *arena;
     const char *buffer;
     size_t len;
     size_t index;
-    size_t lineno;
-    size_t column;
+    size_t lineno() const;
+    size_t column() const;
+    const std::string& filename() const;
     size_t remaining_len() const;
     operator bool() const;
+    // `msg` with the file, line, column and character here, as fail()
+    // throws it.
+    std::string describe(const std::string& msg) const;
     void fail(const std::string& msg) const;
-    std::pair<Token, std::string> token();
+    std::pair<Token, std::string_view> token();
+    void skip_whitespace();
     void bump(size_t len = 1);
-    std::string location();
-    static std::string token_to_string(Token t);
+    std::string location() const;
+    static const char *token_to_string(Token t);
+    // Lists nested deeper than this are an error. Parsing does not recurse,
+    // so the default is no limit.
+    size_t max_depth;
     bool quiet;
   };
 
+  // Every token of a source, lexed once and kept as parallel arrays so the
+  // parser and tools can walk them by index. Lexing stops at the end of
+  // input or at the first byte no token starts with, which is `end`.
+  // Offsets are from the start of the source and limited to 32 bits.
+  struct Pool;
+
+  struct Tape
+  {
+    static Tape lex(const State& state);
+    // Same tape, lexed in pieces of about `chunk` bytes on `pool`.
+    static Tape lex(const State& state, Pool& pool, size_t chunk = 1024 * 1024);
+
+    size_t size() const;
+    std::string_view text(size_t i) const;
+    std::pair<State::Token, std::string_view> operator[](size_t i) const;
+    // A State over the same source positioned at `offset`, for reporting.
+    State at(size_t offset) const;
+
+    std::vector<State::Token> kinds;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> lengths;
+    State state;
+    size_t end;
+  };
+
+  // Byte-class scans behind the lexer's hot loops. Each returns the offset
+  // of the first byte in [from, len) that ends the run, or len. The widest
+  // vector kernels the CPU supports are picked at startup.
+  struct Scan
+  {
+    enum Level { SCALAR, SSE2, AVX2 };
+
+    static Level best();
+    static Level current();
+    // Switches every thread to other kernels, at most best(); meant for
+    // tests and benchmarks.
+    static void use(Level level);
+    static const char *level_to_string(Level level);
+
+    // Spaces, tabs, newlines and carriage returns.
+    static size_t whitespace(const char *buffer, size_t from, size_t len);
+    // Anything but '"', '\\' and NUL.
+    static size_t string_body(const char *buffer, size_t from, size_t len);
+    // Identifier and symbol characters.
+    static size_t name(const char *buffer, size_t from, size_t len);
+  };
+
+  // Reads text from a file descriptor in chunks of `chunk_size` and hands it
+  // out as soon as it holds whole top-level forms, so input of any length
+  // is parsed while it arrives. Tokens and forms split across reads are
+  // kept until the rest shows up.
+  struct Stream
+  {
+    explicit Stream(int fd, const std::string& filename = "", size_t chunk_size = 64 * 1024);
+
+    // The next run of whole top-level forms; at end of input whatever is
+    // left, then an empty State.
+    State next();
+
+  private:
+    void scan();
+
+    int fd;
+    std::string filename;
+    size_t chunk_size;
+    std::string pending;
+    size_t scanned;
+    size_t complete;
+    size_t depth;
+    bool eof;
+    bool broken;
+    // Where the next State handed out starts in the whole input.
+    Source::Origin origin;
+  };
+
+  // Outcome of an internal parse step. On failure `state` is where the
+  // error was found; only the public parse() functions turn it into an
+  // exception.
+  template <typename T>
+  struct Result
+  {
+    State state;
+    T value;
+    const char *error;
+  };
+
+  // Fixed-size run of items living in an Arena.
+  template <typename T>
+  struct Array
+  {
+    T *data;
+    size_t count;
+
+    T *begin() const { return data; }
+    T *end() const { return data + count; }
+    size_t size() const { return count; }
+    T& operator[](size_t i) const { return data[i]; }
+  };
+
+  // Process-wide table giving every distinct identifier or symbol name a
+  // dense id. Each name is stored once and lives until exit. Safe to use
+  // from several threads.
+  struct Names
+  {
+    static std::pair<uint32_t, std::string_view> intern(std::string_view name);
+    static std::string_view name(uint32_t id);
+    static size_t size();
+  };
+
   struct Ident
   {
     bool operator==(const Ident& item) const;
     static std::pair<State, Ident> parse(const State& state);
-    std::string val;
+    static Result<Ident> try_parse(const State& state);
+    uint32_t id;
+    std::string_view val;
     friend std::ostream& operator<<(std::ostream& os, const Ident& item);
   };
   std::ostream& operator<<(std::ostream& os, const Ident& item);
@@ -72,6 +246,7 @@ namespace lang::parser {
   {
     bool operator==(const Number& item) const;
     static std::pair<State, Number> parse(const State& state);
+    static Result<Number> try_parse(const State& state);
 
     union {
       int64_t i;
@@ -88,6 +263,7 @@ namespace lang::parser {
   {
     bool operator==(const Char& item) const;
     static std::pair<State, Char> parse(const State& state);
+    static Result<Char> try_parse(const State& state);
     char val;
     friend std::ostream& operator<<(std::ostream& os, const Char& item);
   };
@@ -97,6 +273,7 @@ namespace lang::parser {
   {
     bool operator==(const Bool& item) const;
     static std::pair<State, Bool> parse(const State& state);
+    static Result<Bool> try_parse(const State& state);
     bool val;
     friend std::ostream& operator<<(std::ostream& os, const Bool& item);
   };
@@ -106,7 +283,8 @@ namespace lang::parser {
   {
     bool operator==(const String& item) const;
     static std::pair<State, String> parse(const State& state);
-    std::string val;
+    static Result<String> try_parse(const State& state);
+    std::string_view val;
     friend std::ostream& operator<<(std::ostream& os, const String& item);
   };
   std::ostream& operator<<(std::ostream& os, const String& item);
@@ -115,20 +293,22 @@ namespace lang::parser {
   {
     bool operator==(const Symbol& item) const;
     static std::pair<State, Symbol> parse(const State& state);
-    std::string val;
+    static Result<Symbol> try_parse(const State& state);
+    uint32_t id;
+    std::string_view val;
     friend std::ostream& operator<<(std::ostream& os, const Symbol& item);
   };
   std::ostream& operator<<(std::ostream& os, const Symbol& item);
 
+  // Atoms, values and lists are handles into the Arena of the File that
+  // parsed them. Copying or moving one copies the handle, never the
+  // subtree; the File frees every node at once.
   struct Atom
   {
     bool operator==(const Atom& item) const;
     static std::pair<State, Atom> parse(const State& state);
+    static Result<Atom> try_parse(const State& state);
     Atom();
-    Atom(const Atom& a);
-    ~Atom();
-
-    Atom& operator=(const Atom& a);
 
     union {
       Number n;
@@ -150,6 +330,7 @@ namespace lang::parser {
   {
     bool operator==(const Value& item) const;
     static std::pair<State, Value> parse(const State& state);
+    static Result<Value> try_parse(const State& state);
 
     union
     {
@@ -166,17 +347,362 @@ namespace lang::parser {
   {
     bool operator==(const List& item) const;
     static std::pair<State, List> parse(const State& state);
-    std::vector<Value> val;
+    static Result<List> try_parse(const State& state);
+    Array<Value> val{nullptr, 0};
     bool is_cons{false};
     friend std::ostream& operator<<(std::ostream& os, const List& item);
   };
   std::ostream& operator<<(std::ostream& os, const List& item);
 
+  // Bump allocator owning AST nodes and their string payloads. Nothing is
+  // freed individually; release() and the destructor drop every block at
+  // once.
+  struct Arena
+  {
+    Arena();
+    Arena(Arena&& a) noexcept;
+    Arena(const Arena&) = delete;
+    ~Arena();
+
+    Arena& operator=(Arena&& a) noexcept;
+    Arena& operator=(const Arena&) = delete;
+
+    void *allocate(size_t size, size_t align);
+    std::string_view copy(std::string_view str);
+    void release();
+    // Drops everything allocated but keeps the newest, largest block for
+    // reuse, so refilling an arena of similar size allocates nothing.
+    void reset();
+    // Takes over every block of `a`, which is left empty.
+    void absorb(Arena&& a);
+
+    template <typename T>
+    T *make()
+    {
+      return new (allocate(sizeof(T), alignof(T))) T();
+    }
+
+    template <typename T>
+    Array<T> array(const T *items, size_t count)
+    {
+      T *data{static_cast<T*>(allocate(sizeof(T) * count, alignof(T)))};
+      std::uninitialized_copy(items, items + count, data);
+      copies += count;
+      return {data, count};
+    }
+
+    size_t blocks;
+    size_t allocations;
+    size_t bytes;
+    size_t copies;      // items copied in by array()
+
+  private:
+    struct Block;
+    Block *head;
+    char *cur;
+    char *end;
+  };
+
+  // Worker threads for running batches of independent tasks. Each worker
+  // owns a queue of task indices and steals from the others once its own
+  // is empty. The thread calling run() works as worker 0.
+  struct Pool
+  {
+    // One worker per hardware thread when `threads` is 0.
+    explicit Pool(size_t threads = 0);
+    Pool(const Pool&) = delete;
+    ~Pool();
+
+    Pool& operator=(const Pool&) = delete;
+
+    size_t size() const;
+    // Calls fn(i, worker) for every i in [0, count) and returns once all
+    // calls have. If any call throws, the rest still run and the first
+    // exception is rethrown from here. Not reentrant.
+    void run(size_t count, const std::function<void(size_t, size_t)>& fn);
+
+  private:
+    struct Queue;
+
+    void loop(size_t worker);
+    void work(size_t worker);
+    bool take(size_t worker, size_t& i);
+
+    std::vector<std::thread> threads;
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::mutex lock;
+    std::condition_variable wake;
+    std::condition_variable done;
+    const std::function<void(size_t, size_t)> *task;
+    size_t generation;
+    std::atomic<size_t> remaining;
+    std::exception_ptr error;
+    bool stopping;
+  };
+
+  // An error found while parsing with recovery, over the bytes it is
+  // about, with the message State::fail would have thrown. Offsets count
+  // from the start of the whole input, which for a Stream is not the start
+  // of the State.
+  struct Diagnostic
+  {
+    size_t start;
+    size_t end;
+    std::string message;
+  };
+
+  // Owns every node reachable from `exprs` through `arena`. Moving a File
+  // moves the blocks, so existing handles stay valid; copying is not
+  // allowed, as it would have to rebuild the whole tree.
   struct File
   {
+    File() = default;
+    File(File&&) noexcept = default;
+    File(const File&) = delete;
+
+    File& operator=(File&&) noexcept = default;
+    File& operator=(const File&) = delete;
+
+    bool operator==(const File& item) const;
     void parse(State& state);
+    // Same result as parse(State&) from the tape's start, without lexing.
+    void parse(const Tape& tape);
+    // Same result as parse(State&), with the input cut into runs of whole
+    // top-level forms about `chunk` bytes long that are parsed on `pool`.
+    void parse(State& state, Pool& pool, size_t chunk = 64 * 1024);
+    // Same as parse(State&), but every error is added to `diagnostics`
+    // instead of thrown, and parsing goes on: a bad token, or a list nested
+    // too deep, is left out of the tree, a stray list end is skipped, and
+    // lists still open at the end of input are closed there.
+    void parse(State& state, std::vector<Diagnostic>& diagnostics);
+    // Brings the File up to date with `state`, the text it was parsed from
+    // after replacing `removed` bytes at `offset` with `inserted` new ones.
+    // Only the forms around the edit are parsed again; the others keep
+    // their nodes. Fails like parse(), leaving the File as it was. Nodes
+    // of replaced forms stay in the arena until the edits have allocated
+    // as much as the last full parse, when the whole text is parsed again.
+    void reparse(const State& state, size_t offset, size_t removed, size_t inserted);
     std::string print();
 
     std::vector<Value> exprs;
+    // Where each form starts and where the next one may start, after any
+    // whitespace and comments, as offsets into the parsed text.
+    std::vector<std::pair<size_t, size_t>> spans;
+    Arena arena;
+    // Bytes the arena held after the last full parse.
+    size_t parsed{0};
+    friend std::ostream& operator<<(std::ostream& os, const File& item);
+  };
+  std::ostream& operator<<(std::ostream& os, const File& item);
+
+  // The top-level forms of a State, parsed one per next() call. Each call
+  // frees the form before it, so memory use is bounded by the largest
+  // form instead of the whole input.
+  struct Forms
+  {
+    // Given `diagnostics`, errors are recorded there and skipped as in
+    // File::parse(State&, std::vector<Diagnostic>&).
+    explicit Forms(const State& state, std::vector<Diagnostic> *diagnostics = nullptr);
+
+    // The next form, or nothing at the end of input. It stays valid until
+    // the following call. Fails like File::parse.
+    std::optional<Value> next();
+
+    State state;
+    Arena arena;
+    std::vector<Diagnostic> *diagnostics;
+    // Tokens read so far, not counting any that failed to parse.
+    size_t tokens;
+  };
+
+  // The structure of a source reported token by token, without building
+  // any nodes. Override the calls of interest; the rest do nothing. Spans
+  // point into the source text and an atom's text is not converted, so
+  // only nesting is tracked and memory use does not grow with the input.
+  struct Events
+  {
+    virtual ~Events() = default;
+
+    virtual void on_list_start(bool is_cons, std::string_view span);
+    virtual void on_list_end(std::string_view span);
+    virtual void on_atom(State::Token kind, std::string_view span);
+
+    // Reports every form of `state` up to the end of input, failing like
+    // File::parse on unbalanced lists, unknown input or nesting deeper
+    // than State::max_depth. Events before the error have been delivered.
+    void parse(State& state);
+  };
+
+  struct FlatFile;
+
+  // A node of a FlatFile, usable wherever a Value is printed or compared.
+  struct FlatValue
+  {
+    bool operator==(const FlatValue& item) const;
+    bool operator==(const Value& item) const;
+
+    const FlatFile *file;
+    size_t index;
+    friend std::ostream& operator<<(std::ostream& os, const FlatValue& item);
+  };
+  std::ostream& operator<<(std::ostream& os, const FlatValue& item);
+
+  // The tree of a File stored as one array of fixed-size records. The
+  // children of every list sit next to each other, starting at `first`, and
+  // the top-level forms are the first `roots` records, so visiting every
+  // node is a linear scan.
+  struct FlatFile
+  {
+    enum Kind : uint8_t { LIST, CONS, INT, FLT, RAT, CHAR, BOOL, STRING, IDENT, SYMBOL };
+
+    struct Node
+    {
+      Kind kind;
+      uint32_t count;     // lists: children, strings: bytes
+      union
+      {
+        uint64_t first;   // lists: index of the first child
+        uint64_t offset;  // strings: offset into `strings`
+        uint32_t id;      // names: id in Names
+        int64_t i;        // integers, numerator of rationals
+        double d;
+        char c;
+        bool b;
+      };
+      int64_t den;        // denominator of rationals
+    };
+
+    FlatFile();
+    explicit FlatFile(const File& file);
+
+    // Builds an empty FlatFile up one top-level form at a time, so the
+    // forms can be freed as they are added, as Forms does. Nodes added
+    // are held by depth until finish() lays them all out as the
+    // constructor from a File would.
+    void add(const Value& form);
+    void finish();
+
+    bool operator==(const FlatFile& item) const;
+    bool operator==(const File& item) const;
+    FlatValue root(size_t i) const;
+    std::string_view text(const Node& n) const;
+    std::string print() const;
+
+    std::vector<Node> nodes;
+    std::string strings;
+    size_t roots;
+    // Nodes added since the last finish(), by depth.
+    std::vector<std::vector<Node>> levels;
+    friend std::ostream& operator<<(std::ostream& os, const FlatFile& item);
+  };
+  std::ostream& operator<<(std::ostream& os, const FlatFile& item);
+
+  // A File saved as one position-independent block and mapped back in
+  // place: a header, the FlatFile node table, the span of every form, the
+  // string pool and the names the nodes use. Loading checks the header
+  // against the source text and every index against the sections it points
+  // into. Identifier and symbol nodes hold indices into the saved names
+  // rather than Names ids.
+  struct AstCache
+  {
+    // Content hash of the source text, which keys the cache.
+    static uint64_t hash(std::string_view text);
+    // `dir`/<hash>.ast, or <source>.ast beside the source if `dir` is empty.
+    static std::string path(const std::string& source, std::string_view text, const std::string& dir = "");
+    // Writes `file`, parsed from `text`, to `path`. False if it cannot.
+    static bool save(const std::string& path, const File& file, std::string_view text);
+    // Same, for a tree already flattened, with the span of each root.
+    static bool save(const std::string& path, FlatFile flat, const std::vector<std::pair<size_t, size_t>>& spans,
+                     std::string_view text);
+    // The cache at `path` if it was saved from exactly `text`, or null.
+    static std::unique_ptr<const AstCache> load(const std::string& path, std::string_view text);
+
+    AstCache(const AstCache&) = delete;
+    ~AstCache();
+    AstCache& operator=(const AstCache&) = delete;
+
+    std::string_view text(const FlatFile::Node& n) const;
+    std::pair<size_t, size_t> span(size_t root) const;
+    std::string print() const;
+
+    const FlatFile::Node *nodes;
+    size_t size;
+    size_t roots;
+    friend std::ostream& operator<<(std::ostream& os, const AstCache& item);
+
+  private:
+    AstCache(const void *map, size_t map_size);
+
+    const void *map;
+    size_t map_size;
+    const uint64_t *spans;
+    const uint64_t *name_offsets;
+    const char *name_bytes;
+    std::string_view strings;
+  };
+  std::ostream& operator<<(std::ostream& os, const AstCache& item);
+
+  // Writes trees byte for byte as operator<< does, but formats straight
+  // into one reusable buffer, numbers with to_chars, and hands the buffer
+  // to write(2) on `fd` each time it fills. Without an fd the text is
+  // kept, for str().
+  struct Printer
+  {
+    explicit Printer(int fd = -1, size_t capacity = 64 * 1024);
+    Printer(const Printer&) = delete;
+    // Flushes.
+    ~Printer();
+
+    Printer& operator=(const Printer&) = delete;
+
+    Printer& print(std::string_view text);
+    Printer& print(const Atom& item);
+    Printer& print(const Value& item);
+    Printer& print(const File& item);
+    Printer& print(const FlatFile& item);
+    Printer& print(const AstCache& item);
+    // One KIND:text line per token.
+    Printer& print(const Tape& item);
+    // One 13-byte record per token: the kind byte, the offset plus `base`
+    // in 8 bytes and the length in 4, both little-endian.
+    Printer& records(const Tape& item, uint64_t base = 0);
+    // Writes out everything buffered. False once a write has failed.
+    bool flush();
+    // What is buffered and not yet written.
+    std::string_view str() const;
+
+  private:
+    struct Open
+    {
+      const Value *next;
+      const Value *end;
+    };
+
+    char *room(size_t n);
+    void integer(int64_t i);
+    void real(double d);
+    void number(const Number& n);
+    template <typename F>
+    void flat(const F& file);
+
+    int fd;
+    std::string buffer;
+    size_t used;
+    bool failed;
+    std::vector<Open> lists;
+  };
+}
+
+namespace std {
+  template <>
+  struct hash<lang::parser::Ident>
+  {
+    size_t operator()(const lang::parser::Ident& item) const { return item.id; }
+  };
+
+  template <>
+  struct hash<lang::parser::Symbol>
+  {
+    size_t operator()(const lang::parser::Symbol& item) const { return item.id; }
   };
 }
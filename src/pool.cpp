@@ -0,0 +1,167 @@
+#include <parser.h>
+
+namespace lang::parser {
+  using namespace lang::parser;
+
+  struct Pool::Queue
+  {
+    std::mutex lock;
+    std::deque<size_t> tasks;
+  };
+
+  Pool::Pool(size_t threads)
+    : threads()
+    , queues()
+    , lock()
+    , wake()
+    , done()
+    , task(0)
+    , generation(0)
+    , remaining(0)
+    , error()
+    , stopping(false)
+  {
+    if (threads == 0)
+    {
+      threads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    }
+
+    for (size_t w = 0; w < threads; w++)
+    {
+      queues.push_back(std::make_unique<Queue>());
+    }
+    // The thread calling run() is worker 0.
+    for (size_t w = 1; w < threads; w++)
+    {
+      this->threads.emplace_back([this, w]() { loop(w); });
+    }
+  }
+
+  Pool::~Pool()
+  {
+    {
+      std::lock_guard<std::mutex> l{lock};
+      stopping = true;
+    }
+    wake.notify_all();
+    for (auto& t : threads)
+    {
+      t.join();
+    }
+  }
+
+  size_t Pool::size() const
+  {
+    return queues.size();
+  }
+
+  // Each worker starts with a contiguous run of indices, so neighbouring
+  // tasks tend to run on the same thread, and steals from the far end of
+  // other queues once its own is empty.
+  void Pool::run(size_t count, const std::function<void(size_t, size_t)>& fn)
+  {
+    task = &fn;
+    remaining = count;
+    for (size_t w = 0; w < queues.size(); w++)
+    {
+      std::lock_guard<std::mutex> l{queues[w]->lock};
+      for (size_t i = count * w / queues.size(); i < count * (w + 1) / queues.size(); i++)
+      {
+        queues[w]->tasks.push_back(i);
+      }
+    }
+
+    {
+      std::lock_guard<std::mutex> l{lock};
+      generation++;
+    }
+    wake.notify_all();
+
+    work(0);
+
+    std::unique_lock<std::mutex> l{lock};
+    done.wait(l, [this]() { return remaining == 0; });
+
+    std::exception_ptr e{std::move(error)};
+    error = nullptr;
+    if (e)
+    {
+      std::rethrow_exception(e);
+    }
+  }
+
+  void Pool::loop(size_t worker)
+  {
+    size_t seen{0};
+
+    while (true)
+    {
+      {
+        std::unique_lock<std::mutex> l{lock};
+        wake.wait(l, [&]() { return stopping || generation != seen; });
+        if (stopping)
+        {
+          return;
+        }
+        seen = generation;
+      }
+
+      work(worker);
+    }
+  }
+
+  void Pool::work(size_t worker)
+  {
+    size_t i;
+
+    while (take(worker, i))
+    {
+      // A task that escaped would end a worker thread, or leave run() while
+      // the others still use `fn`; the first one is kept for run() instead.
+      try
+      {
+        (*task)(i, worker);
+      }
+      catch (...)
+      {
+        std::lock_guard<std::mutex> l{lock};
+        if (!error)
+        {
+          error = std::current_exception();
+        }
+      }
+      if (--remaining == 0)
+      {
+        std::lock_guard<std::mutex> l{lock};
+        done.notify_all();
+      }
+    }
+  }
+
+  bool Pool::take(size_t worker, size_t& i)
+  {
+    bool found{false};
+
+    for (size_t k = 0; !found && k < queues.size(); k++)
+    {
+      Queue& q{*queues[(worker + k) % queues.size()]};
+      std::lock_guard<std::mutex> l{q.lock};
+      if (!q.tasks.empty())
+      {
+        if (k == 0)
+        {
+          i = q.tasks.front();
+          q.tasks.pop_front();
+        }
+        else
+        {
+          i = q.tasks.back();
+          q.tasks.pop_back();
+        }
+        found = true;
+      }
+    }
+
+    return found;
+  }
+}
@@ -0,0 +1,296 @@
+#include <parser.h>
+
+#include <charconv>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+
+namespace lang::parser {
+  using namespace lang::parser;
+
+  Printer::Printer(int fd_, size_t capacity)
+    : fd(fd_)
+    , buffer(std::max<size_t>(capacity, 64), '\0')
+    , used(0)
+    , failed(false)
+    , lists()
+  {}
+
+  Printer::~Printer()
+  {
+    flush();
+  }
+
+  bool Printer::flush()
+  {
+    for (size_t done = 0; fd >= 0 && !failed && done < used;)
+    {
+      ssize_t n{write(fd, buffer.data() + done, used - done)};
+      if (n > 0)
+      {
+        done += n;
+      }
+      else if (n == 0 || errno != EINTR)
+      {
+        failed = true;
+      }
+    }
+    used = fd >= 0 ? 0 : used;
+    return !failed;
+  }
+
+  std::string_view Printer::str() const
+  {
+    return std::string_view(buffer.data(), used);
+  }
+
+  // Makes room for `n` more bytes: by writing out what is buffered when
+  // there is an fd, and by growing when there is none or `n` is larger
+  // than the whole buffer.
+  char *Printer::room(size_t n)
+  {
+    if (used + n > buffer.size() && fd >= 0)
+    {
+      flush();
+    }
+    if (used + n > buffer.size())
+    {
+      buffer.resize(std::max(buffer.size() * 2, used + n));
+    }
+    return buffer.data() + used;
+  }
+
+  Printer& Printer::print(std::string_view text)
+  {
+    memcpy(room(text.size()), text.data(), text.size());
+    used += text.size();
+    return *this;
+  }
+
+  void Printer::integer(int64_t i)
+  {
+    char *first{room(24)};
+    used = std::to_chars(first, first + 24, i).ptr - buffer.data();
+  }
+
+  // %g with six digits, which is what an ostream does with a double by
+  // default.
+  void Printer::real(double d)
+  {
+    char *first{room(32)};
+    used = std::to_chars(first, first + 32, d, std::chars_format::general, 6).ptr - buffer.data();
+  }
+
+  void Printer::number(const Number& n)
+  {
+    switch (n.kind)
+    {
+    case Number::F:
+      print("Float(");
+      real(n.d);
+      print(")");
+      break;
+    case Number::N:
+      print("Integer(");
+      integer(n.i);
+      print(")");
+      break;
+    case Number::R:
+      print("Rational(");
+      integer(n.r.first);
+      print("/");
+      integer(n.r.second);
+      print(")");
+      break;
+    default:
+      print("Number(Uninitialized)");
+    }
+  }
+
+  Printer& Printer::print(const Atom& item)
+  {
+    print("A(");
+    switch (item.kind)
+    {
+    case Atom::NU:
+      number(item.n);
+      break;
+    case Atom::CH:
+      print("Char(").print(std::string_view(&item.c.val, 1)).print(")");
+      break;
+    case Atom::BL:
+      print(item.b.val ? "Bool(true)" : "Bool(false)");
+      break;
+    case Atom::ST:
+      item.s ? print("String(").print(item.s->val).print(")") : print("Uninitialized String");
+      break;
+    case Atom::ID:
+      item.i ? print("Ident(").print(item.i->val).print(")") : print("Uninitialized Ident");
+      break;
+    case Atom::SY:
+      item.sy ? print("Symbol('").print(item.sy->val).print(")") : print("Uninitialized Symbol");
+      break;
+    }
+    print(")");
+    return *this;
+  }
+
+  // Walks the tree with an explicit stack, like the parser, so any depth
+  // that parses also prints.
+  Printer& Printer::print(const Value& item)
+  {
+    const size_t base{lists.size()};
+
+    auto start = [&](const Value& v) {
+      bool open{v.kind == Value::L && v.l};
+      if (open)
+      {
+        print("V(L( ");
+        lists.push_back({v.l->val.begin(), v.l->val.end()});
+      }
+      else
+      {
+        print("V(");
+        v.kind == Value::L ? print("L(uninit)") : v.a ? print(*v.a) : print("A(uninit)");
+        print(")");
+      }
+      return open;
+    };
+
+    start(item);
+    while (lists.size() > base)
+    {
+      Open& o{lists.back()};
+      if (o.next == o.end)
+      {
+        lists.pop_back();
+        print(lists.size() > base ? ")) " : "))");
+      }
+      else if (!start(*o.next++))
+      {
+        print(" ");
+      }
+    }
+
+    return *this;
+  }
+
+  Printer& Printer::print(const File& item)
+  {
+    print("File(");
+    for (auto& v : item.exprs)
+    {
+      print(v);
+    }
+    return print(")");
+  }
+
+  // The same walk over a node table. Node kinds map one to one onto atom
+  // kinds, and names and strings come from the file's own text().
+  template <typename F>
+  void Printer::flat(const F& file)
+  {
+    std::vector<std::pair<size_t, size_t>> open;
+
+    print("File(");
+    for (size_t r = 0; r < file.roots; r++)
+    {
+      open.push_back({r, r + 1});
+      while (!open.empty())
+      {
+        auto& o{open.back()};
+        if (o.first == o.second)
+        {
+          open.pop_back();
+          print(open.empty() ? "" : open.size() == 1 ? "))" : ")) ");
+          continue;
+        }
+
+        const FlatFile::Node& n{file.nodes[o.first++]};
+        bool child{open.size() > 1};
+        switch (n.kind)
+        {
+        case FlatFile::LIST:
+        case FlatFile::CONS:
+          print("V(L( ");
+          open.push_back({n.first, n.first + n.count});
+          continue;
+        case FlatFile::INT:
+          print("V(A(Integer(");
+          integer(n.i);
+          break;
+        case FlatFile::FLT:
+          print("V(A(Float(");
+          real(n.d);
+          break;
+        case FlatFile::RAT:
+          print("V(A(Rational(");
+          integer(n.i);
+          print("/");
+          integer(n.den);
+          break;
+        case FlatFile::CHAR:
+          print("V(A(Char(").print(std::string_view(&n.c, 1));
+          break;
+        case FlatFile::BOOL:
+          print(n.b ? "V(A(Bool(true" : "V(A(Bool(false");
+          break;
+        case FlatFile::STRING:
+          print("V(A(String(").print(file.text(n));
+          break;
+        case FlatFile::IDENT:
+          print("V(A(Ident(").print(file.text(n));
+          break;
+        case FlatFile::SYMBOL:
+          print("V(A(Symbol('").print(file.text(n));
+          break;
+        }
+        print(child ? "))) " : ")))");
+      }
+    }
+    print(")");
+  }
+
+  Printer& Printer::print(const FlatFile& item)
+  {
+    flat(item);
+    return *this;
+  }
+
+  Printer& Printer::print(const AstCache& item)
+  {
+    flat(item);
+    return *this;
+  }
+
+  Printer& Printer::print(const Tape& item)
+  {
+    for (size_t i = 0; i < item.size(); i++)
+    {
+      print(State::token_to_string(item.kinds[i])).print(":").print(item.text(i)).print("\n");
+    }
+    return *this;
+  }
+
+  Printer& Printer::records(const Tape& item, uint64_t base)
+  {
+    for (size_t i = 0; i < item.size(); i++)
+    {
+      unsigned char *r{reinterpret_cast<unsigned char*>(room(13))};
+      uint64_t offset{item.offsets[i] + base};
+      uint32_t length{item.lengths[i]};
+
+      r[0] = item.kinds[i];
+      for (size_t b = 0; b < 8; b++)
+      {
+        r[1 + b] = offset >> (8 * b);
+      }
+      for (size_t b = 0; b < 4; b++)
+      {
+        r[9 + b] = length >> (8 * b);
+      }
+      used += 13;
+    }
+    return *this;
+  }
+}
@@ -0,0 +1,317 @@
+#include <parser.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+namespace lang::parser {
+  using namespace lang::parser;
+
+  namespace {
+    const char *name_chars{
+      "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ~!@$%^&*_+=|:<>?/0123456789.-"};
+
+    struct NameTable
+    {
+      NameTable()
+        : is_name()
+      {
+        for (const char *c = name_chars; *c; c++)
+        {
+          is_name[static_cast<unsigned char>(*c)] = true;
+        }
+      }
+
+      bool is_name[256];
+    };
+
+    const NameTable names;
+
+    size_t whitespace_scalar(const char *buffer, size_t from, size_t len)
+    {
+      for (; from < len; from++)
+      {
+        char c{buffer[from]};
+        if (c != ' ' && c != '\t' && c != '\n' && c != '\r')
+        {
+          break;
+        }
+      }
+      return from;
+    }
+
+    size_t string_body_scalar(const char *buffer, size_t from, size_t len)
+    {
+      for (; from < len; from++)
+      {
+        char c{buffer[from]};
+        if (c == '"' || c == '\\' || c == '\0')
+        {
+          break;
+        }
+      }
+      return from;
+    }
+
+    size_t name_scalar(const char *buffer, size_t from, size_t len)
+    {
+      for (; from < len && names.is_name[static_cast<unsigned char>(buffer[from])]; from++)
+      {}
+      return from;
+    }
+
+#if defined(__x86_64__)
+
+    // Each kernel tests a block of bytes at once and finishes the tail
+    // with the scalar loop. `mask` has a bit set for every byte that ends
+    // the run.
+    size_t whitespace_sse2(const char *buffer, size_t from, size_t len)
+    {
+      const __m128i sp{_mm_set1_epi8(' ')}, tab{_mm_set1_epi8('\t')};
+      const __m128i nl{_mm_set1_epi8('\n')}, cr{_mm_set1_epi8('\r')};
+
+      for (; from + 16 <= len; from += 16)
+      {
+        __m128i c{_mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + from))};
+        __m128i ws{_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, sp), _mm_cmpeq_epi8(c, tab)),
+                                _mm_or_si128(_mm_cmpeq_epi8(c, nl), _mm_cmpeq_epi8(c, cr)))};
+        unsigned mask{~static_cast<unsigned>(_mm_movemask_epi8(ws)) & 0xffff};
+        if (mask)
+        {
+          return from + __builtin_ctz(mask);
+        }
+      }
+
+      return whitespace_scalar(buffer, from, len);
+    }
+
+    size_t string_body_sse2(const char *buffer, size_t from, size_t len)
+    {
+      const __m128i quote{_mm_set1_epi8('"')}, slash{_mm_set1_epi8('\\')}, nul{_mm_setzero_si128()};
+
+      for (; from + 16 <= len; from += 16)
+      {
+        __m128i c{_mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + from))};
+        __m128i stop{_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, quote), _mm_cmpeq_epi8(c, slash)),
+                                  _mm_cmpeq_epi8(c, nul))};
+        unsigned mask{static_cast<unsigned>(_mm_movemask_epi8(stop))};
+        if (mask)
+        {
+          return from + __builtin_ctz(mask);
+        }
+      }
+
+      return string_body_scalar(buffer, from, len);
+    }
+
+    // Name characters are the visible ASCII bytes except the delimiters
+    // " # ' ( ) , ; [ ] ` { } and backslash. Bytes from 0x80 up are
+    // negative as signed chars, so the compare against '!' rules them out
+    // along with the control bytes. Clearing bit 0 or setting bit 5 first
+    // lets one compare catch a pair of excluded bytes, e.g. ( and ), or
+    // [ and {.
+    size_t name_sse2(const char *buffer, size_t from, size_t len)
+    {
+      const __m128i bang{_mm_set1_epi8('!')}, del{_mm_set1_epi8(0x7f)};
+      const __m128i bit0{_mm_set1_epi8(0x01)}, bit5{_mm_set1_epi8(0x20)};
+      const __m128i quote{_mm_set1_epi8('"')}, paren{_mm_set1_epi8('(')}, slash{_mm_set1_epi8('\\')};
+      const __m128i open{_mm_set1_epi8('{')}, close{_mm_set1_epi8('}')};
+      const __m128i tick{_mm_set1_epi8('\'')}, comma{_mm_set1_epi8(',')};
+      const __m128i semi{_mm_set1_epi8(';')}, back{_mm_set1_epi8('`')};
+
+      for (; from + 16 <= len; from += 16)
+      {
+        __m128i c{_mm_loadu_si128(reinterpret_cast<const __m128i*>(buffer + from))};
+        __m128i even{_mm_andnot_si128(bit0, c)};
+        __m128i lower{_mm_or_si128(c, bit5)};
+        __m128i out{_mm_or_si128(_mm_cmpgt_epi8(bang, c), _mm_cmpeq_epi8(c, del))};
+        __m128i pairs{_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(even, quote), _mm_cmpeq_epi8(even, paren)),
+                                   _mm_or_si128(_mm_cmpeq_epi8(even, slash),
+                                                _mm_or_si128(_mm_cmpeq_epi8(lower, open), _mm_cmpeq_epi8(lower, close))))};
+        __m128i single{_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(c, tick), _mm_cmpeq_epi8(c, comma)),
+                                    _mm_or_si128(_mm_cmpeq_epi8(c, semi), _mm_cmpeq_epi8(c, back)))};
+        out = _mm_or_si128(out, _mm_or_si128(pairs, single));
+        unsigned mask{static_cast<unsigned>(_mm_movemask_epi8(out))};
+        if (mask)
+        {
+          return from + __builtin_ctz(mask);
+        }
+      }
+
+      return name_scalar(buffer, from, len);
+    }
+
+    __attribute__((target("avx2")))
+    size_t whitespace_avx2(const char *buffer, size_t from, size_t len)
+    {
+      const __m256i sp{_mm256_set1_epi8(' ')}, tab{_mm256_set1_epi8('\t')};
+      const __m256i nl{_mm256_set1_epi8('\n')}, cr{_mm256_set1_epi8('\r')};
+
+      for (; from + 32 <= len; from += 32)
+      {
+        __m256i c{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer + from))};
+        __m256i ws{_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, sp), _mm256_cmpeq_epi8(c, tab)),
+                                   _mm256_or_si256(_mm256_cmpeq_epi8(c, nl), _mm256_cmpeq_epi8(c, cr)))};
+        unsigned mask{~static_cast<unsigned>(_mm256_movemask_epi8(ws))};
+        if (mask)
+        {
+          return from + __builtin_ctz(mask);
+        }
+      }
+
+      return whitespace_sse2(buffer, from, len);
+    }
+
+    __attribute__((target("avx2")))
+    size_t string_body_avx2(const char *buffer, size_t from, size_t len)
+    {
+      const __m256i quote{_mm256_set1_epi8('"')}, slash{_mm256_set1_epi8('\\')}, nul{_mm256_setzero_si256()};
+
+      for (; from + 32 <= len; from += 32)
+      {
+        __m256i c{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer + from))};
+        __m256i stop{_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(c, quote), _mm256_cmpeq_epi8(c, slash)),
+                                     _mm256_cmpeq_epi8(c, nul))};
+        unsigned mask{static_cast<unsigned>(_mm256_movemask_epi8(stop))};
+        if (mask)
+        {
+          return from + __builtin_ctz(mask);
+        }
+      }
+
+      return string_body_sse2(buffer, from, len);
+    }
+
+    // Bit h of by_low[l] is set when byte 0xhl is a name character, so a
+    // byte is one when by_low[low nibble] & by_high[high nibble] != 0. The
+    // tables are looked up 32 bytes at a time with vpshufb.
+    struct NibbleTables
+    {
+      NibbleTables()
+        : by_low()
+        , by_high()
+      {
+        for (size_t c = 0; c < 128; c++)
+        {
+          by_low[c & 0xf] |= names.is_name[c] ? 1 << (c >> 4) : 0;
+        }
+        for (size_t h = 0; h < 8; h++)
+        {
+          by_high[h] = 1 << h;
+        }
+      }
+
+      uint8_t by_low[16];
+      uint8_t by_high[16];
+    };
+
+    const NibbleTables nibbles;
+
+    __attribute__((target("avx2")))
+    size_t name_avx2(const char *buffer, size_t from, size_t len)
+    {
+      const __m256i by_low{_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(nibbles.by_low)))};
+      const __m256i by_high{_mm256_broadcastsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(nibbles.by_high)))};
+      const __m256i low_bits{_mm256_set1_epi8(0xf)};
+
+      for (; from + 32 <= len; from += 32)
+      {
+        __m256i c{_mm256_loadu_si256(reinterpret_cast<const __m256i*>(buffer + from))};
+        __m256i low{_mm256_shuffle_epi8(by_low, _mm256_and_si256(c, low_bits))};
+        __m256i high{_mm256_shuffle_epi8(by_high, _mm256_and_si256(_mm256_srli_epi16(c, 4), low_bits))};
+        __m256i out{_mm256_cmpeq_epi8(_mm256_and_si256(low, high), _mm256_setzero_si256())};
+        unsigned mask{static_cast<unsigned>(_mm256_movemask_epi8(out))};
+        if (mask)
+        {
+          return from + __builtin_ctz(mask);
+        }
+      }
+
+      return name_sse2(buffer, from, len);
+    }
+#endif
+
+    struct Kernels
+    {
+      size_t (*whitespace)(const char *, size_t, size_t);
+      size_t (*string_body)(const char *, size_t, size_t);
+      size_t (*name)(const char *, size_t, size_t);
+    };
+
+    Kernels kernels_for(Scan::Level level)
+    {
+      switch (level)
+      {
+#if defined(__x86_64__)
+      case Scan::AVX2:
+        return {whitespace_avx2, string_body_avx2, name_avx2};
+      case Scan::SSE2:
+        return {whitespace_sse2, string_body_sse2, name_sse2};
+#endif
+      default:
+        return {whitespace_scalar, string_body_scalar, name_scalar};
+      }
+    }
+
+    // Scalar until static initialization picks the best kernels, so text
+    // lexed from other static initializers is still handled.
+    Scan::Level level{Scan::SCALAR};
+    Kernels kernels{whitespace_scalar, string_body_scalar, name_scalar};
+    const bool picked{(Scan::use(Scan::best()), true)};
+  }
+
+  Scan::Level Scan::best()
+  {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2") ? AVX2 : SSE2;
+#else
+    return SCALAR;
+#endif
+  }
+
+  Scan::Level Scan::current()
+  {
+    return level;
+  }
+
+  void Scan::use(Level l)
+  {
+    level = std::min(l, best());
+    kernels = kernels_for(level);
+  }
+
+  const char *Scan::level_to_string(Level l)
+  {
+    const char *out{"SCALAR"};
+
+    switch (l)
+    {
+    case SSE2:
+      out = "SSE2";
+      break;
+    case AVX2:
+      out = "AVX2";
+      break;
+    default:
+      break;
+    }
+
+    return out;
+  }
+
+  size_t Scan::whitespace(const char *buffer, size_t from, size_t len)
+  {
+    return kernels.whitespace(buffer, from, len);
+  }
+
+  size_t Scan::string_body(const char *buffer, size_t from, size_t len)
+  {
+    return kernels.string_body(buffer, from, len);
+  }
+
+  size_t Scan::name(const char *buffer, size_t from, size_t len)
+  {
+    return kernels.name(buffer, from, len);
+  }
+}
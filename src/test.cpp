@@ -1,78 +1,1203 @@
 #include <parser.h>
+#include <cstdio>
 #include <cstring>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <streambuf>
+#include <atomic>
+#include <functional>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <fcntl.h>
+#include <unistd.h>
 
 using namespace lang::parser;
 
+// Counts bytes allocated through operator new, including inside liblang,
+// for checks that must not depend on timing.
+std::atomic<size_t> alloc_bytes{0};
+
+void *operator new(size_t size)
+{
+  alloc_bytes += size;
+  void *p{malloc(size)};
+  if (!p)
+  {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void operator delete(void *p) noexcept
+{
+  free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+  free(p);
+}
+
+// Types whose nodes or text live in the State's arena; the others must
+// parse without one.
+template <typename T>
+constexpr bool allocates{std::is_same_v<T, String> || std::is_same_v<T, Atom> || std::is_same_v<T, List> ||
+                         std::is_same_v<T, Value>};
+
 template <typename T>
 bool test_parse(const std::string& name, const std::string& type, const std::string& input, const std::string& expected)
 {
-  State s{State::from_string(input)};
-  s.filename = name;
+  State s{State::from_string(input, name)};
+  Arena arena;
+  if (allocates<T>)
+  {
+    bool refused{false};
+    try
+    {
+      T::parse(s);
+    }
+    catch (const std::runtime_error& e)
+    {
+      refused = std::string(e.what()).find("No arena to parse into") == 0;
+    }
+    if (!refused)
+    {
+      std::cout << "Parsed " << type << " without an arena" << std::endl;
+      std::cout << "Test " << name << " of type " << type << ": fail" << std::endl;
+      return false;
+    }
+    s.arena = &arena;
+  }
+
+  auto output{T::parse(s)};
+  std::stringstream ss;
+  ss << output.second;
+  bool eq{ss.str().compare(expected) == 0};
+  if (!eq)
+  {
+    std::cout << "Unequal; got '" << output.second << "', expected '" << expected << "'" << std::endl;
+  }
+  else
+  {
+    std::cout << "Equal; got '" << output.second << "'" << std::endl;
+  }
+  std::cout << "Test " << name << " of type " << type << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+bool test_tokenize(const std::string& name, const std::string& input, const std::vector<std::string>& expected)
+{
+  State s{State::from_string(input, name)};
+
+  std::vector<std::pair<State::Token, std::string_view>> output;
+  while (s)
+  {
+    output.push_back(s.token());
+  }
+
+  bool eq{true};
+  for (size_t i = 0; i < output.size() || i < expected.size(); i++)
+  {
+    if (i < output.size() && i < expected.size())
+    {
+      if (expected[i].compare(output[i].second) == 0)
+      {
+        std::cout << i << ": Equal; " << State::token_to_string(output[i].first) << ":'" << output[i].second << "'." << std::endl;
+      }
+      else
+      {
+        eq = false;
+        std::cout << i << ": Unequal; got " << State::token_to_string(output[i].first) << ":'" << output[i].second << "'"
+         << "; expected '" << expected[i] << "'." << std::endl;
+      }
+    }
+    else if (i < output.size())
+    {
+      eq = false;
+      std::cout << i << ": Extra token in output: " << State::token_to_string(output[i].first) << ":'" << output[i].second << "'." << std::endl;
+    }
+    else
+    {
+      eq = false;
+      std::cout << i << ": Missing token in output: '" << expected[i] << "'." << std::endl;
+    }
+  }
+
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+
+  return eq;
+}
+
+// Events are checked against the expected trace, and must fail exactly
+// where File::parse does. A trailing "!" in the trace stands for an error.
+bool test_events(const std::string& name, const std::string& input, const std::vector<std::string>& expected)
+{
+  struct Trace : Events
+  {
+    void on_list_start(bool is_cons, std::string_view span) override
+    {
+      out.push_back((is_cons ? "C" : "L") + std::string(span));
+    }
+
+    void on_list_end(std::string_view span) override
+    {
+      out.push_back(std::string(span));
+    }
+
+    void on_atom(State::Token kind, std::string_view span) override
+    {
+      out.push_back(State::token_to_string(kind) + (":" + std::string(span)));
+    }
+
+    std::vector<std::string> out;
+  } trace;
+
+  std::string error, file_error;
+  try
+  {
+    State s{State::from_string(input, name)};
+    trace.parse(s);
+  }
+  catch (const std::exception& e)
+  {
+    error = e.what();
+    trace.out.push_back("!");
+  }
+  try
+  {
+    State s{State::from_string(input, name)};
+    File f;
+    f.parse(s);
+  }
+  catch (const std::exception& e)
+  {
+    file_error = e.what();
+  }
+
+  bool eq{trace.out == expected && error == file_error};
+  for (auto& e : trace.out)
+  {
+    std::cout << e << " ";
+  }
+  std::cout << error << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+bool test_flat(const std::string& name, const std::string& input)
+{
+  State s{State::from_string(input, name)};
+  File f;
+  f.parse(s);
+  FlatFile flat{f};
+
+  // Built form by form, the layout must be the same, list by list.
+  FlatFile added;
+  Forms forms{State::from_string(input, name)};
+  while (auto v = forms.next())
+  {
+    added.add(*v);
+  }
+  added.finish();
+  bool laid_out{added == flat};
+  for (size_t i = 0; laid_out && i < flat.nodes.size(); i++)
+  {
+    bool list{flat.nodes[i].kind == FlatFile::LIST || flat.nodes[i].kind == FlatFile::CONS};
+    laid_out = !list || added.nodes[i].first == flat.nodes[i].first;
+  }
+
+  bool eq{flat.print().compare(f.print()) == 0 && flat == f && flat == FlatFile(f) && laid_out};
+  if (!eq)
+  {
+    std::cout << "Unequal; got '" << flat << "', expected '" << f << "'" << std::endl;
+  }
+  else
+  {
+    std::cout << "Equal; got '" << flat << "'" << std::endl;
+  }
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// Every kernel level must stop at the same byte as the scalar one, from
+// every start offset of buffers made of the bytes each scan cares about.
+bool test_scan(const std::string& name, size_t size)
+{
+  const char alphabet[]{" \t\n\r\"\\azAZ09-.?~()';#\x80\xff"};
+  std::vector<std::string> inputs;
+  for (size_t n = 0; n < 64; n++)
+  {
+    std::string input;
+    for (size_t i = 0; i < size; i++)
+    {
+      // Long runs of one class, broken up now and then.
+      size_t k{(i * 7 + n) % (sizeof(alphabet) - 1)};
+      input += alphabet[(i * 31 + n * 17) % 61 < 3 ? k : (n % 4) * (n % 5 == 0 ? 1 : 4)];
+    }
+    inputs.push_back(input);
+  }
+
+  using Kernel = size_t (*)(const char *, size_t, size_t);
+  const Kernel kernels[]{Scan::whitespace, Scan::string_body, Scan::name};
+  std::vector<size_t> expected;
+
+  Scan::use(Scan::SCALAR);
+  for (auto& k : kernels)
+  {
+    for (auto& input : inputs)
+    {
+      for (size_t from = 0; from <= input.size(); from++)
+      {
+        expected.push_back(k(input.data(), from, input.size()));
+      }
+    }
+  }
+
+  bool eq{true};
+  for (int level = Scan::SSE2; level <= Scan::best(); level++)
+  {
+    Scan::use(static_cast<Scan::Level>(level));
+    size_t e{0};
+    for (auto& k : kernels)
+    {
+      for (auto& input : inputs)
+      {
+        for (size_t from = 0; from <= input.size(); from++)
+        {
+          eq = eq && k(input.data(), from, input.size()) == expected[e++];
+        }
+      }
+    }
+    std::cout << "Checked " << Scan::level_to_string(Scan::current()) << " kernels against SCALAR" << std::endl;
+  }
+  Scan::use(Scan::best());
+
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// `\n` in the input stands for a newline, since tests are one per line.
+bool test_location(const std::string& name, const std::string& input, const std::string& expected)
+{
+  std::string data{input};
+  for (size_t i = 0; (i = data.find("\\n", i)) != std::string::npos; )
+  {
+    data.replace(i, 2, "\n");
+  }
+
+  std::string got;
+  try
+  {
+    State s{State::from_string(data, name)};
+    File f;
+    f.parse(s);
+  }
+  catch (std::runtime_error& e)
+  {
+    got = e.what();
+  }
+
+  std::string at{" at " + name + ":" + expected + " "};
+  bool eq{got.find(at) != std::string::npos};
+  if (!eq)
+  {
+    std::cout << "Unequal; got '" << got << "', expected position " << expected << std::endl;
+  }
+  else
+  {
+    std::cout << "Equal; got '" << got << "'" << std::endl;
+  }
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// The file is padded to end exactly on a page boundary, so the lexer must
+// stop at the end of the mapping rather than at a terminator.
+bool test_file(const std::string& name, const std::string& input)
+{
+  std::string data{input};
+  data.append(4095 - data.size() % 4096, ' ');
+  data += "x";
+
+  std::string path{"/tmp/lang-test-" + name};
+  std::ofstream(path) << data;
+  File expected, mapped, piped;
+  State e{State::from_string(data, name)};
+  State m{State::from_file(path)};
+  expected.parse(e);
+  mapped.parse(m);
+
+  int fds[2];
+  bool eq{pipe(fds) == 0};
+  if (eq)
+  {
+    std::thread writer([&]() {
+      for (size_t done = 0; done < data.size();)
+      {
+        ssize_t n{write(fds[1], data.data() + done, data.size() - done)};
+        done += n > 0 ? n : data.size();
+      }
+      close(fds[1]);
+    });
+    State p{State::from_file("/dev/fd/" + std::to_string(fds[0]))};
+    writer.join();
+    close(fds[0]);
+    piped.parse(p);
+  }
+  remove(path.c_str());
+
+  eq = eq && expected.exprs.size() > 0 && mapped == expected && piped == expected;
+  if (!eq)
+  {
+    std::cout << "Unequal; got '" << mapped << "' and '" << piped << "', expected '" << expected << "'" << std::endl;
+  }
+  else
+  {
+    std::cout << "Equal; got " << mapped.exprs.size() << " forms from " << data.size() << " bytes" << std::endl;
+  }
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// Feeds `input` through a pipe read `chunk` bytes at a time, so tokens and
+// forms straddle reads. The first form must come out before the rest of
+// the input is written.
+bool test_stream(const std::string& name, size_t chunk, const std::string& input)
+{
+  State e{State::from_string(input, name)};
+  File expected;
+  expected.parse(e);
+
+  std::string first{input.substr(0, input.find(')') + 1)};
+  std::string rest{input.substr(first.size())};
+  int fds[2];
+  bool eq{pipe(fds) == 0};
+  size_t pieces{0};
+  std::string printed;
+
+  if (eq)
+  {
+    Stream stream{fds[0], name, chunk};
+    eq = write(fds[1], first.data(), first.size()) == static_cast<ssize_t>(first.size());
+
+    State s{stream.next()};
+    File f;
+    f.parse(s);
+    eq = eq && f.exprs.size() == 1 && f.exprs[0] == expected.exprs[0];
+    if (eq)
+    {
+      std::stringstream ss;
+      ss << f.exprs[0];
+      printed += ss.str();
+    }
+
+    eq = eq && write(fds[1], rest.data(), rest.size()) == static_cast<ssize_t>(rest.size());
+    close(fds[1]);
+    for (pieces = 1; (s = stream.next()); pieces++)
+    {
+      File g;
+      g.parse(s);
+      for (auto& v : g.exprs)
+      {
+        std::stringstream ss;
+        ss << v;
+        printed += ss.str();
+      }
+    }
+    close(fds[0]);
+  }
+
+  eq = eq && "File(" + printed + ")" == expected.print();
+  if (!eq)
+  {
+    std::cout << "Unequal; got 'File(" << printed << ")', expected '" << expected << "'" << std::endl;
+  }
+  else
+  {
+    std::cout << "Equal; got " << expected.exprs.size() << " forms in " << pieces << " pieces" << std::endl;
+  }
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// Errors in a streamed input must be reported where they are in the whole
+// input, not in the chunk they arrived in. The last line has a bad token,
+// and lines hold two forms so chunks also start mid-line.
+bool test_stream_errors(const std::string& name, size_t chunk, size_t lines)
+{
+  std::string input;
+  for (size_t i = 1; i <= lines; i++)
+  {
+    input += i == lines ? "(c #) (d)\n" : "(a " + std::to_string(i) + ") (b)\n";
+  }
+
+  State e{State::from_string(input, name)};
+  File expected;
+  std::vector<Diagnostic> want;
+  expected.parse(e, want);
+
+  std::string path{"/tmp/lang-test-" + name};
+  {
+    std::ofstream out{path, std::ios::binary};
+    out << input;
+  }
+  int fd{open(path.c_str(), O_RDONLY)};
+  Stream stream{fd, name, chunk};
+  std::vector<Diagnostic> got;
+  size_t pieces{0};
+  for (State s; (s = stream.next()); pieces++)
+  {
+    File f;
+    f.parse(s, got);
+  }
+  close(fd);
+  unlink(path.c_str());
+
+  bool eq{got.size() == want.size() && !want.empty()};
+  for (size_t i = 0; eq && i < got.size(); i++)
+  {
+    eq = got[i].start == want[i].start && got[i].end == want[i].end && got[i].message == want[i].message;
+  }
+
+  std::cout << (got.empty() ? "" : got.back().message) << " in " << pieces << " pieces" << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+static_assert(std::is_trivially_copyable_v<Value> && std::is_trivially_copyable_v<List>,
+              "AST nodes are handles, copying one must not clone a subtree");
+static_assert(!std::is_copy_constructible_v<File> && std::is_nothrow_move_constructible_v<File> &&
+              std::is_nothrow_move_assignable_v<File>, "Files own their arena and can only be moved");
+
+// Each parsed item is copied into its parent's arena array exactly once, so
+// a nesting `depth` deep must cost `depth` copies, not one per level per item.
+bool test_copies(const std::string& name, size_t depth)
+{
+  std::string input(depth, '(');
+  input += "x";
+  input.append(depth, ')');
+
+  State s{State::from_string(input, name)};
+  File f;
+  f.parse(s);
+  std::string printed{f.print()};
+  size_t nodes{FlatFile(f).nodes.size()};
+  size_t copies{f.arena.copies};
+  bool eq{copies == nodes - f.exprs.size()};
+
+  File g{std::move(f)};
+  eq = eq && g.print() == printed && f.exprs.empty() && f.arena.blocks == 0;
+
+  File h;
+  h = std::move(g);
+  eq = eq && h.print() == printed && g.exprs.empty() && h.arena.copies == copies;
+
+  std::cout << "Parsed depth " << depth << " with " << copies << " copies for " << nodes << " nodes" << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// Forms must print the same as the File and count the tokens the tape
+// has, and reusing one arena block per form must keep memory flat however
+// many forms there are.
+bool test_forms(const std::string& name, const std::string& input)
+{
+  State s{State::from_string(input, name)};
+  File f;
+  f.parse(s);
+
+  std::stringstream ss;
+  ss << "File(";
+  Forms forms{State::from_string(input, name)};
+  while (auto v = forms.next())
+  {
+    ss << *v;
+  }
+  ss << ")";
+  bool eq{ss.str() == f.print() && forms.tokens == Tape::lex(State::from_string(input, name)).size()};
+
+  std::string many;
+  for (size_t i = 0; i < 10000; i++)
+  {
+    many += input + "\n";
+  }
+  Forms more{State::from_string(many, name)};
+  size_t count{0}, blocks{0};
+  while (more.next())
+  {
+    count++;
+    blocks = std::max(blocks, more.arena.blocks);
+  }
+  eq = eq && count == 10000 * f.exprs.size() && blocks <= 1;
+
+  std::cout << ss.str() << std::endl;
+  std::cout << "Read " << count << " forms with at most " << blocks << " arena blocks" << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// The edit is whatever differs between `before` and `after`. Reparsing
+// must give the tree and spans of a fresh parse while keeping the nodes
+// of `reused` forms.
+bool test_reparse(const std::string& name, size_t reused, const std::string& before, const std::string& after)
+{
+  size_t prefix{0}, suffix{0};
+  for (; prefix < before.size() && prefix < after.size() && before[prefix] == after[prefix]; prefix++)
+  {}
+  for (; suffix + prefix < before.size() && suffix + prefix < after.size() &&
+         before[before.size() - suffix - 1] == after[after.size() - suffix - 1]; suffix++)
+  {}
+  size_t removed{before.size() - prefix - suffix}, inserted{after.size() - prefix - suffix};
+
+  State s{State::from_string(before, name)};
+  File f;
+  f.parse(s);
+  std::vector<Value> old{f.exprs};
+
+  State t{State::from_string(after, name)};
+  File g;
+  g.parse(t);
+
+  std::string error;
+  try
+  {
+    f.reparse(State::from_string(after, name), prefix, removed, inserted);
+  }
+  catch (const std::exception& e)
+  {
+    error = e.what();
+  }
+
+  size_t kept{0};
+  for (auto& v : f.exprs)
+  {
+    for (auto& o : old)
+    {
+      kept += v.l == o.l;
+    }
+  }
+  bool eq{error.empty() && f == g && f.spans == g.spans && kept == reused};
+
+  std::cout << "Edit at " << prefix << " replacing " << removed << " bytes with " << inserted
+    << ", kept " << kept << " of " << f.exprs.size() << " forms " << error << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// Many small edits, each growing or shrinking one of `forms` forms, must
+// end in the tree of a fresh parse without the arena growing with them.
+bool test_reparse_many(const std::string& name, size_t forms, size_t edits)
+{
+  std::string text;
+  std::vector<size_t> digits;
+  for (size_t k = 0; k < forms; k++)
+  {
+    text += "(form \"text\" ";
+    digits.push_back(text.size());
+    text += "1)\n";
+  }
+
+  File f;
+  State s{State::from_string(text, name)};
+  f.parse(s);
+
+  size_t most{0};
+  for (size_t i = 0; i < edits; i++)
+  {
+    size_t k{i % forms};
+    bool grow{text[digits[k] + 1] == ')'};
+    text.replace(digits[k], grow ? 1 : 2, grow ? "22" : "1");
+    for (size_t j = k + 1; j < forms; j++)
+    {
+      digits[j] = grow ? digits[j] + 1 : digits[j] - 1;
+    }
+    f.reparse(State::from_string(text, name), digits[k], grow ? 1 : 2, grow ? 2 : 1);
+    most = std::max(most, f.arena.blocks);
+  }
+
+  File g;
+  State t{State::from_string(text, name)};
+  g.parse(t);
+  bool eq{f == g && f.spans == g.spans && most <= g.arena.blocks + 2};
+
+  std::cout << edits << " edits used at most " << most << " arena blocks, a fresh parse "
+    << g.arena.blocks << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// Recovering must keep the good parts of the tree, report every error by
+// its byte span, report the first one exactly as parse() throws it, and
+// give the same through Forms.
+bool test_recover(const std::string& name, const std::string& input, const std::string& tree,
+                  const std::vector<std::string>& expected)
+{
+  State s{State::from_string(input, name)};
+  File f;
+  std::vector<Diagnostic> diagnostics;
+  f.parse(s, diagnostics);
+
+  std::vector<std::string> got;
+  for (auto& d : diagnostics)
+  {
+    got.push_back(std::to_string(d.start) + "-" + std::to_string(d.end));
+    std::cout << d.message << std::endl;
+  }
+
+  std::string thrown;
+  try
+  {
+    State t{State::from_string(input, name)};
+    File g;
+    g.parse(t);
+  }
+  catch (const std::exception& e)
+  {
+    thrown = e.what();
+  }
+
+  std::stringstream ss;
+  ss << "File(";
+  std::vector<Diagnostic> streamed;
+  Forms forms{State::from_string(input, name), &streamed};
+  while (auto v = forms.next())
+  {
+    ss << *v;
+  }
+  ss << ")";
+
+  bool eq{f.print() == tree && got == expected && ss.str() == tree && streamed.size() == diagnostics.size() &&
+          (diagnostics.empty() ? thrown.empty() : thrown == diagnostics[0].message)};
+  std::cout << f.print() << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// A saved cache must print and span exactly like the File, and must not
+// load for any other text or once truncated.
+bool test_cache(const std::string& name, const std::string& input)
+{
+  State s{State::from_string(input, name)};
+  File f;
+  f.parse(s);
+
+  std::string path{AstCache::path("/tmp/lang-test-" + name, input)};
+  bool eq{AstCache::save(path, f, input)};
+  auto cache{AstCache::load(path, input)};
+  eq = eq && cache && cache->print() == f.print() && cache->roots == f.exprs.size();
+  for (size_t i = 0; eq && i < cache->roots; i++)
+  {
+    eq = cache->span(i) == f.spans[i];
+  }
+
+  eq = eq && !AstCache::load(path, input + " ") && !AstCache::load(path + ".missing", input);
+  std::string other{input};
+  other[0] = other[0] == '(' ? '[' : '(';
+  eq = eq && !AstCache::load(path, other);
+
+  std::string bytes;
+  {
+    std::ifstream in{path, std::ios::binary};
+    bytes.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  std::ofstream(path, std::ios::binary | std::ios::trunc).write(bytes.data(), bytes.size() - 1);
+  eq = eq && !AstCache::load(path, input);
+
+  // Same size, but one node pointing outside its section, breaking the
+  // tree or holding a bool other than 0 or 1: the nodes follow the 80-byte
+  // header.
+  const size_t header{80};
+  auto rejects = [&](size_t i, const std::function<void(FlatFile::Node&)>& corrupt) {
+    std::string bad{bytes};
+    FlatFile::Node n;
+    memcpy(&n, &bad[header + i * sizeof(n)], sizeof(n));
+    corrupt(n);
+    memcpy(&bad[header + i * sizeof(n)], &n, sizeof(n));
+    std::ofstream(path, std::ios::binary | std::ios::trunc).write(bad.data(), bad.size());
+    return !AstCache::load(path, input);
+  };
+  size_t nodes{cache ? cache->size : 0};
+  cache.reset();
+  for (size_t i = 0; eq && i < nodes; i++)
+  {
+    FlatFile::Node n;
+    memcpy(&n, &bytes[header + i * sizeof(n)], sizeof(n));
+    switch (n.kind)
+    {
+    case FlatFile::LIST:
+    case FlatFile::CONS:
+      eq = rejects(i, [](FlatFile::Node& n) { n.count = UINT32_MAX; }) &&
+        rejects(i, [&](FlatFile::Node& n) { n.first = i; }) &&
+        rejects(i, [](FlatFile::Node& n) { n.first++; }) &&
+        rejects(i, [](FlatFile::Node& n) { n.count++; });
+      break;
+    case FlatFile::BOOL:
+      eq = rejects(i, [](FlatFile::Node& n) { n.first = 2; });
+      break;
+    case FlatFile::STRING:
+      eq = rejects(i, [](FlatFile::Node& n) { n.offset += 1 << 20; });
+      break;
+    case FlatFile::IDENT:
+    case FlatFile::SYMBOL:
+      eq = rejects(i, [](FlatFile::Node& n) { n.id += 1 << 20; });
+      break;
+    default:
+      eq = rejects(i, [](FlatFile::Node& n) { n.kind = FlatFile::Kind(99); });
+    }
+  }
+  unlink(path.c_str());
+
+  std::cout << "Cached " << bytes.size() << " bytes for " << nodes << " nodes" << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// The Printer must match operator<< byte for byte, for trees, flat files
+// and caches, both kept in memory and written through a small buffer to
+// an fd.
+bool test_printer(const std::string& name, const std::string& input)
+{
+  State s{State::from_string(input, name)};
+  File f;
+  f.parse(s);
+  FlatFile flat{f};
+  std::stringstream ss, fs;
+  ss << f;
+  fs << flat;
+
+  Printer p;
+  bool eq{std::string(p.print(f).str()) == ss.str() && ss.str() == fs.str() && flat.print() == ss.str()};
+
+  std::string path{"/tmp/lang-test-" + name};
+  AstCache::save(path, f, input);
+  auto cache{AstCache::load(path, input)};
+  eq = eq && cache && Printer().print(*cache).str() == ss.str();
+  unlink(path.c_str());
+
+  {
+    int fd{open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644)};
+    Printer out{fd, 16};
+    out.print(f).print("\n");
+    for (auto& v : f.exprs)
+    {
+      out.print(v);
+    }
+    eq = eq && out.flush() && close(fd) == 0;
+  }
+  std::string written;
+  {
+    std::ifstream in{path, std::ios::binary};
+    written.assign(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+  }
+  unlink(path.c_str());
+  eq = eq && written == ss.str() + "\n" + ss.str().substr(5, ss.str().size() - 6);
+
+  std::cout << p.str() << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// Token output as astdump -t writes it: one KIND:text line per token, or
+// 13-byte records that must decode back to the tape, offset by the base.
+bool test_tokens(const std::string& name, const std::string& input)
+{
+  State s{State::from_string(input, name)};
+  Tape tape{Tape::lex(s)};
+  const uint64_t base{uint64_t(1) << 33};
+  std::string lines;
+
+  for (size_t i = 0; i < tape.size(); i++)
+  {
+    lines += State::token_to_string(tape.kinds[i]) + std::string(":") + std::string(tape.text(i)) + "\n";
+  }
+  bool eq{Printer().print(tape).str() == lines};
+
+  Printer p;
+  std::string_view records{p.records(tape, base).str()};
+  eq = eq && records.size() == 13 * tape.size();
+  for (size_t i = 0; eq && i < tape.size(); i++)
+  {
+    const unsigned char *r{reinterpret_cast<const unsigned char*>(records.data()) + 13 * i};
+    uint64_t offset{0};
+    uint32_t length{0};
+    for (size_t b = 0; b < 8; b++)
+    {
+      offset |= uint64_t(r[1 + b]) << (8 * b);
+    }
+    for (size_t b = 0; b < 4; b++)
+    {
+      length |= uint32_t(r[9 + b]) << (8 * b);
+    }
+    eq = r[0] == tape.kinds[i] && offset == tape.offsets[i] + base && length == tape.lengths[i];
+  }
+
+  std::cout << lines << tape.size() << " records" << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// astdump -t must print the same tokens for a file piped to it as for the
+// file named, as text and as records, even when a byte no token starts
+// with comes after the first 64 KB read from the pipe. Runs the astdump
+// built beside this test.
+bool test_dump_tokens(const std::string& name, size_t lines)
+{
+  std::string input;
+  for (size_t i = 0; i < 2 * lines; i++)
+  {
+    input += i == lines ? "(c ] d)\n" : "(a " + std::to_string(i) + " \"s\")\n";
+  }
+  std::string path{"/tmp/lang-test-" + name};
+  std::ofstream(path, std::ios::binary | std::ios::trunc) << input;
+
+  auto run = [](const std::string& command) {
+    std::string out;
+    FILE *p{popen(command.c_str(), "r")};
+    char buf[4096];
+    size_t n;
+    while (p && (n = fread(buf, 1, sizeof(buf), p)) > 0)
+    {
+      out.append(buf, n);
+    }
+    bool ok{p && pclose(p) == 0};
+    return ok ? out : "!";
+  };
+
+  std::string text{run("./astdump -t " + path)};
+  std::string binary{run("./astdump -t -b " + path)};
+  bool eq{input.size() > 64 * 1024 && text != "!" && binary != "!" && text == run("./astdump -t < " + path) &&
+          binary == run("./astdump -t -b < " + path)};
+  unlink(path.c_str());
+
+  std::cout << text.size() << " bytes of tokens, " << binary.size() << " of records" << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// Trees and flat files must agree on whether two inputs are equal; a list
+// and a cons of the same items are not.
+bool test_equal(const std::string& name, const std::string& a, const std::string& b, bool expected)
+{
+  State sa{State::from_string(a, name)};
+  State sb{State::from_string(b, name)};
+  File fa, fb;
+  fa.parse(sa);
+  fb.parse(sb);
+  FlatFile ga{fa}, gb{fb};
 
-  auto output{T::parse(s)};
+  bool eq{(fa == fb) == expected && (ga == gb) == expected && (ga == fb) == expected && (gb == fa) == expected};
+
+  std::cout << a << (expected ? " == " : " != ") << b << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// Nesting is only bounded by State::max_depth, not the native stack. The
+// tree is walked by hand since comparing still recurses; the Printer does
+// not, and prints 8 bytes per level around the atom.
+bool test_depth(const std::string& name, size_t depth, size_t limit)
+{
+  std::string input(depth, '(');
+  input += "x";
+  input.append(depth, ')');
+
+  auto walk = [&](const File& f) {
+    bool eq{f.exprs.size() == 1};
+    Value v{eq ? f.exprs[0] : Value{}};
+    for (size_t d = 0; eq && d < depth; d++)
+    {
+      eq = v.kind == Value::L && v.l->val.size() == 1;
+      v = eq ? v.l->val[0] : v;
+    }
+    return eq && v.kind == Value::A && v.a->kind == Atom::ID && v.a->i->val == "x" &&
+      Printer().print(f).str().size() == 8 * depth + 20;
+  };
+  std::string expected{"List nested deeper than the limit at " + name + ":1:" + std::to_string(limit + 1) + " char '('"};
+
+  bool eq{true};
+  for (bool tape : {false, true})
+  {
+    State s{State::from_string(input, name)};
+    s.max_depth = limit;
+    File f;
+    std::string error;
+    try
+    {
+      tape ? f.parse(Tape::lex(s)) : f.parse(s);
+    }
+    catch (const std::exception& e)
+    {
+      error = e.what();
+    }
+    eq = eq && (depth <= limit ? error.empty() && walk(f) : error == expected);
+    if (!error.empty())
+    {
+      std::cout << error << std::endl;
+    }
+  }
+
+  std::cout << "Parsed depth " << depth << " with limit " << limit << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// The tree followed by the span of every form, so two ways of parsing
+// are checked to agree on both.
+std::string print_with_spans(const File& f)
+{
   std::stringstream ss;
-  ss << output.second;
-  bool eq{ss.str().compare(expected) == 0};
+  ss << f;
+  for (auto& span : f.spans)
+  {
+    ss << " " << span.first << "-" << span.second;
+  }
+  return ss.str();
+}
+
+// Parsing from a tape must give the same tree, or the same error, as
+// parsing straight from the State.
+bool test_tape(const std::string& name, const std::string& input)
+{
+  std::string expected, got;
+  try
+  {
+    State s{State::from_string(input, name)};
+    File f;
+    f.parse(s);
+    expected = print_with_spans(f);
+  }
+  catch (std::runtime_error& e)
+  {
+    expected = e.what();
+  }
+
+  State s{State::from_string(input, name)};
+  Tape tape{Tape::lex(s)};
+  try
+  {
+    File f;
+    f.parse(tape);
+    got = print_with_spans(f);
+  }
+  catch (std::runtime_error& e)
+  {
+    got = e.what();
+  }
+
+  bool eq{got == expected};
+  for (size_t i = 0; eq && i < tape.size(); i++)
+  {
+    eq = input.compare(tape.offsets[i], tape.lengths[i], tape.text(i)) == 0;
+  }
+
   if (!eq)
   {
-    std::cout << "Unequal; got '" << output.second << "', expected '" << expected << "'" << std::endl;
+    std::cout << "Unequal; got '" << got << "', expected '" << expected << "'" << std::endl;
   }
   else
   {
-    std::cout << "Equal; got '" << output.second << "'" << std::endl;
+    std::cout << "Equal; got '" << got << "' from " << tape.size() << " tokens" << std::endl;
   }
-  std::cout << "Test " << name << " of type " << type << ": " << (eq ? "pass" : "fail") << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
   return eq;
 }
 
-bool test_tokenize(const std::string& name, const std::string& input, const std::vector<std::string>& expected)
+// Every top-level form becomes its own chunk, so the pool has plenty to
+// steal; the tree, or the error, must match the serial parse.
+bool test_parallel(const std::string& name, size_t threads, const std::string& input)
 {
-  State s{State::from_string(input)};
-  s.filename = name;
-
-  std::vector<std::pair<State::Token, std::string>> output;
-  while (s)
+  std::string expected, got;
+  try
   {
-    output.push_back(s.token());
+    State s{State::from_string(input, name)};
+    File f;
+    f.parse(s);
+    expected = print_with_spans(f);
+  }
+  catch (std::runtime_error& e)
+  {
+    expected = e.what();
   }
 
-  bool eq{true};
-  for (size_t i = 0; i < output.size() || i < expected.size(); i++)
+  Pool pool{threads};
+  for (size_t round = 0; round < 2; round++)
   {
-    if (i < output.size() && i < expected.size())
+    try
     {
-      if (expected[i].compare(output[i].second) == 0)
+      State s{State::from_string(input, name)};
+      File f;
+      f.parse(s, pool, 1);
+      got = print_with_spans(f);
+    }
+    catch (std::runtime_error& e)
+    {
+      got = e.what();
+    }
+  }
+
+  bool eq{got == expected};
+  if (!eq)
+  {
+    std::cout << "Unequal; got '" << got << "', expected '" << expected << "'" << std::endl;
+  }
+  else
+  {
+    std::cout << "Equal; got '" << got << "' on " << pool.size() << " threads" << std::endl;
+  }
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+// Tasks that throw must not end the batch: every other task still runs,
+// run() rethrows the first exception, and the pool stays usable.
+bool test_pool_errors(const std::string& name, size_t threads)
+{
+  Pool pool{threads};
+  std::atomic<size_t> ran{0};
+  std::string error;
+
+  try
+  {
+    pool.run(100, [&](size_t i, size_t) {
+      if (i % 7 == 3)
       {
-        std::cout << i << ": Equal; " << State::token_to_string(output[i].first) << ":'" << output[i].second << "'." << std::endl;
+        throw std::runtime_error("task " + std::to_string(i));
       }
-      else
+      ran++;
+    });
+  }
+  catch (std::runtime_error& e)
+  {
+    error = e.what();
+  }
+
+  size_t first{ran};
+  pool.run(100, [&](size_t, size_t) { ran++; });
+  bool eq{first == 86 && ran == 186 && error.compare(0, 5, "task ") == 0};
+
+  std::cout << "Ran " << first << " tasks, then " << ran - first << "; caught '" << error << "' on " << pool.size()
+    << " threads" << std::endl;
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+bool same_tape(const Tape& a, const Tape& b)
+{
+  return a.kinds == b.kinds && a.offsets == b.offsets && a.lengths == b.lengths && a.end == b.end;
+}
+
+// Cuts land everywhere, including inside strings and chars that span
+// lines, so seams get fixed up both ways; the tape must match the serial
+// one for every piece size.
+bool test_parallel_lex(const std::string& name, size_t threads, const std::string& input)
+{
+  std::string data;
+  for (size_t i = 0; i < 8; i++)
+  {
+    data += input + (i % 3 ? "\n" : " ");
+  }
+  for (size_t i = 0; (i = data.find("\\n", i)) != std::string::npos; )
+  {
+    data.replace(i, 2, "\n");
+  }
+
+  State s{State::from_string(data, name)};
+  Tape expected{Tape::lex(s)};
+  Pool pool{threads};
+  bool eq{true};
+  size_t chunk{1};
+
+  for (; eq && chunk < data.size(); chunk++)
+  {
+    eq = same_tape(Tape::lex(s, pool, chunk), expected);
+  }
+
+  if (!eq)
+  {
+    std::cout << "Unequal with " << chunk - 1 << " byte pieces" << std::endl;
+  }
+  else
+  {
+    std::cout << "Equal; got " << expected.size() << " tokens with every piece size on " << pool.size() << " threads" << std::endl;
+  }
+  std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
+  return eq;
+}
+
+bool test_names(const std::string& name, size_t threads)
+{
+  const size_t count{1000};
+  std::vector<std::vector<uint32_t>> ids(threads);
+  std::vector<std::thread> workers;
+
+  for (size_t t = 0; t < threads; t++)
+  {
+    workers.emplace_back([&ids, t]() {
+      for (size_t i = 0; i < count; i++)
       {
-        eq = false;
-        std::cout << i << ": Unequal; got " << State::token_to_string(output[i].first) << ":'" << output[i].second << "'"
-         << "; expected '" << expected[i] << "'." << std::endl;
+        ids[t].push_back(Names::intern("name-" + std::to_string(i)).first);
       }
-    }
-    else if (i < output.size())
-    {
-      eq = false;
-      std::cout << i << ": Extra token in output: " << State::token_to_string(output[i].first) << ":'" << output[i].second << "'." << std::endl;
-    }
-    else
+    });
+  }
+  for (auto& w : workers)
+  {
+    w.join();
+  }
+
+  bool eq{true};
+  for (size_t i = 0; eq && i < count; i++)
+  {
+    for (size_t t = 1; eq && t < threads; t++)
     {
-      eq = false;
-      std::cout << i << ": Missing token in output: '" << expected[i] << "'." << std::endl;
+      eq = ids[t][i] == ids[0][i];
     }
+    eq = eq && Names::name(ids[0][i]).compare("name-" + std::to_string(i)) == 0;
   }
 
+  std::cout << "Interned " << count << " names from " << threads << " threads" << std::endl;
   std::cout << "Test " << name << ": " << (eq ? "pass" : "fail") << std::endl;
-
   return eq;
 }
 
+size_t parse_bytes(const std::string& input)
+{
+  State s{State::from_string(input)};
+  size_t before{alloc_bytes};
+  File f;
+  f.parse(s);
+  return alloc_bytes - before;
+}
+
+bool test_scaling(const std::string& name, size_t size)
+{
+  const std::string form{"(witty-comeback no-u\n  (:respond (lambda () \"no, u\" 3.14159 'sym)))\n"};
+  std::string small, large;
+  while (small.size() < size / 10)
+  {
+    small += form;
+  }
+  for (size_t i = 0; i < 10; i++)
+  {
+    large += small;
+  }
+
+  size_t b_small{parse_bytes(small)};
+  size_t b_large{parse_bytes(large)};
+  double ratio{double(b_large) / b_small};
+
+  // Linear parsing allocates about 10 times as much for 10 times the
+  // input; copying the source per token made it closer to 100.
+  bool ok{ratio < 20};
+  std::cout << "Parsed " << small.size() << " bytes allocating " << b_small << ", "
+    << large.size() << " bytes allocating " << b_large << "; ratio " << ratio << std::endl;
+  std::cout << "Test " << name << ": " << (ok ? "pass" : "fail") << std::endl;
+
+  return ok;
+}
+
 int main(int argc, char **argv)
 {
   std::vector<std::vector<std::string>> tests;
@@ -129,6 +1254,164 @@ int main(int argc, char **argv)
         std::string input{*it++};
         test_tokenize(name, input, std::vector<std::string>(it, s.end()));
       }
+      else if (it->compare("h") == 0 && s.size() > 3)
+      {
+        it++;
+        std::string name{*it++};
+        std::string input{*it++};
+        test_events(name, input, std::vector<std::string>(it, s.end()));
+      }
+      else if (it->compare("i") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_forms(name, *it);
+      }
+      else if (it->compare("r") == 0 && s.size() == 5)
+      {
+        it++;
+        std::string name{*it++};
+        size_t reused{std::stoull(*it++)};
+        std::string before{*it++};
+        test_reparse(name, reused, before, *it);
+      }
+      else if (it->compare("l") == 0 && s.size() == 4)
+      {
+        it++;
+        std::string name{*it++};
+        size_t forms{std::stoull(*it++)};
+        test_reparse_many(name, forms, std::stoull(*it));
+      }
+      else if (it->compare("g") == 0 && s.size() > 3)
+      {
+        it++;
+        std::string name{*it++};
+        std::string input{*it++};
+        std::string tree{*it++};
+        test_recover(name, input, tree, std::vector<std::string>(it, s.end()));
+      }
+      else if (it->compare("w") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_cache(name, *it);
+      }
+      else if (it->compare("o") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_printer(name, *it);
+      }
+      else if (it->compare("q") == 0 && s.size() == 5)
+      {
+        it++;
+        std::string name{*it++};
+        std::string a{*it++};
+        std::string b{*it++};
+        test_equal(name, a, b, it->compare("same") == 0);
+      }
+      else if (it->compare("z") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_pool_errors(name, std::stoull(*it));
+      }
+      else if (it->compare("y") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_dump_tokens(name, std::stoull(*it));
+      }
+      else if (it->compare("b") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_tokens(name, *it);
+      }
+      else if (it->compare("a") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_tape(name, *it);
+      }
+      else if (it->compare("v") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_scan(name, std::stoull(*it));
+      }
+      else if (it->compare("e") == 0 && s.size() == 4)
+      {
+        it++;
+        std::string name{*it++};
+        std::string input{*it++};
+        test_location(name, input, *it);
+      }
+      else if (it->compare("f") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_flat(name, *it);
+      }
+      else if (it->compare("c") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_copies(name, std::stoull(*it));
+      }
+      else if (it->compare("d") == 0 && s.size() == 4)
+      {
+        it++;
+        std::string name{*it++};
+        size_t depth{std::stoull(*it++)};
+        test_depth(name, depth, std::stoull(*it));
+      }
+      else if (it->compare("j") == 0 && s.size() == 4)
+      {
+        it++;
+        std::string name{*it++};
+        size_t threads{std::stoull(*it++)};
+        test_parallel(name, threads, *it);
+      }
+      else if (it->compare("x") == 0 && s.size() == 4)
+      {
+        it++;
+        std::string name{*it++};
+        size_t threads{std::stoull(*it++)};
+        test_parallel_lex(name, threads, *it);
+      }
+      else if (it->compare("k") == 0 && s.size() == 4)
+      {
+        it++;
+        std::string name{*it++};
+        size_t chunk{std::stoull(*it++)};
+        test_stream(name, chunk, *it);
+      }
+      else if (it->compare("u") == 0 && s.size() == 4)
+      {
+        it++;
+        std::string name{*it++};
+        size_t chunk{std::stoull(*it++)};
+        test_stream_errors(name, chunk, std::stoull(*it));
+      }
+      else if (it->compare("m") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_file(name, *it);
+      }
+      else if (it->compare("n") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_names(name, std::stoull(*it));
+      }
+      else if (it->compare("s") == 0 && s.size() == 3)
+      {
+        it++;
+        std::string name{*it++};
+        test_scaling(name, std::stoull(*it));
+      }
       else if (it->compare("p") == 0 && s.size() == 5)
       {
         it++;